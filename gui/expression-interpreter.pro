@@ -8,6 +8,12 @@ QT       += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+# QProcess::errorOccurred, used to report an interpreter that can't be
+# started, appeared in Qt 5.6.
+lessThan(QT_MAJOR_VERSION, 5)|if(equals(QT_MAJOR_VERSION, 5):lessThan(QT_MINOR_VERSION, 6)) {
+    error("Qt 5.6 or later is required")
+}
+
 TARGET = expression-interpreter
 TEMPLATE = app
 
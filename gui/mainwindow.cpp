@@ -53,14 +53,22 @@
 
 #include "mainwindow.h"
 
+// Output window keeps at most this many characters of output, the rest is
+// dropped, so that a program that prints a lot doesn't freeze the editor.
+static const int maxOutputSize = 1 << 20;
+
 //! [0]
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent)
+    : QMainWindow(parent), process(nullptr), outputSize(0), stopped(false)
 {
     setupFileMenu();
     setupHelpMenu();
 
-    menuBar()->addAction(tr("&Run"), this, SLOT(run()));
+    this->runAction = menuBar()->addAction(tr("&Run"), this, SLOT(run()));
+    this->runAction->setShortcut(QKeySequence(Qt::Key_F5));
+    this->stopAction = menuBar()->addAction(tr("&Stop"), this, SLOT(stop()));
+    this->stopAction->setShortcut(QKeySequence(Qt::SHIFT | Qt::Key_F5));
+    this->stopAction->setEnabled(false);
 
     this->verticalWidget = new QWidget(this);
 
@@ -78,6 +86,7 @@ MainWindow::MainWindow(QWidget *parent)
     this->vboxLayout->addWidget(this->errWindow);
 
     setCentralWidget(this->verticalWidget);
+    setupStatusBar();
     setWindowTitle(tr("Syntax Highlighter"));
 }
 //! [0]
@@ -145,7 +154,12 @@ void MainWindow::showErrors(const QString &err) {
     }
 
     for (auto &&e : errors) {
+        // Only errors with a column, like `ERROR:4,0-4,4:...', can be
+        // underlined.  Runtime errors have just a line and notes have none.
         auto errorParts = e.split(":");
+        if (errorParts.size() < 3 || errorParts[0] != "ERROR"
+                || !errorParts[1].contains(","))
+            continue;
         auto posInfo = errorParts[1].split("-");
         QString beginInfo = posInfo[0];
         QString endInfo = posInfo.size() > 1 ? posInfo[1] : "";
@@ -166,29 +180,142 @@ void MainWindow::showErrors(const QString &err) {
 
 void MainWindow::run()
 {
-    auto process = new QProcess(this);
+    if (this->process != nullptr)
+        return;
+
+    this->errWindow->clear();
+    this->stderrOutput.clear();
+    this->outputSize = 0;
+    this->stopped = false;
+
+    this->process = new QProcess(this);
+    connect(this->process, &QProcess::readyReadStandardOutput,
+            this, &MainWindow::readOutput);
+    connect(this->process, &QProcess::readyReadStandardError,
+            this, &MainWindow::readErrors);
+    connect(this->process,
+            static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(
+                &QProcess::finished),
+            this, &MainWindow::runFinished);
+    connect(this->process, &QProcess::errorOccurred,
+            this, &MainWindow::runFailed);
+
     QString exeFile = QFileInfo( QCoreApplication::applicationFilePath() ).dir().absolutePath()
                 + "/../../interpreter/interpreter.exe";
-    process->start(exeFile);
+    QStringList arguments;
+    if (this->cacheDir.isValid())
+        arguments << "--cache=" + this->cacheDir.path();
+
+    // Program is buffered by QProcess and written once the process starts.
+    // If it fails to start, runFailed() may already have reset the member,
+    // while the object itself is deleted later.
+    auto process = this->process;
+    this->setRunning(true);
+    process->start(exeFile, arguments);
+    process->write(this->editor->toPlainText().toUtf8());
+    process->closeWriteChannel();
+}
 
-    if (!process->waitForStarted()) {
-        throw std::invalid_argument("not started");
-    }
+void MainWindow::stop()
+{
+    if (this->process == nullptr)
+        return;
 
-    auto programTextString = this->editor->toPlainText().toStdString();
-    process->write(programTextString.c_str());
-    process->closeWriteChannel();
+    this->stopped = true;
+    this->process->kill();
+}
 
-    if (!process->waitForFinished()) {
-        throw std::invalid_argument("not finished");
-    }
+void MainWindow::appendOutput(const QString &text)
+{
+    if (this->outputSize >= maxOutputSize)
+        return;
+
+    QString part = text.left(maxOutputSize - this->outputSize);
+    this->outputSize += part.size();
+    if (this->outputSize >= maxOutputSize)
+        part += tr("\n... output is too long, the rest is not shown\n");
+
+    // Text is appended at the end without moving the view, so the output
+    // can be scrolled while the program runs.
+    QTextCursor cursor(this->errWindow->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(part);
+}
 
-    auto resultData = process->readAll();
-    auto stderrOutput = QString(process->readAllStandardError());
-    auto resultString = QString(resultData) + stderrOutput;
-    this->errWindow->setPlainText(resultString);
+void MainWindow::readOutput()
+{
+    if (this->process == nullptr)
+        return;
+    this->appendOutput(QString::fromUtf8(this->process->readAllStandardOutput()));
+}
 
-    this->showErrors(stderrOutput);
+void MainWindow::readErrors()
+{
+    if (this->process == nullptr)
+        return;
+    auto errors = QString::fromUtf8(this->process->readAllStandardError());
+    this->stderrOutput += errors;
+    this->appendOutput(errors);
+}
+
+void MainWindow::runFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    this->readOutput();
+    this->readErrors();
+
+    auto seconds = QString::number(this->runTimer.elapsed() / 1000.0, 'f', 1);
+    if (this->stopped)
+        this->statusLabel->setText(tr("Stopped after %1 s").arg(seconds));
+    else if (exitStatus == QProcess::CrashExit)
+        this->statusLabel->setText(tr("Interpreter crashed after %1 s").arg(seconds));
+    else
+        this->statusLabel->setText(tr("Finished in %1 s, exit code %2")
+                                   .arg(seconds).arg(exitCode));
+
+    this->process->deleteLater();
+    this->process = nullptr;
+    this->setRunning(false);
+
+    if (!this->stopped)
+        this->showErrors(this->stderrOutput);
+}
+
+void MainWindow::runFailed(QProcess::ProcessError error)
+{
+    // Other errors are followed by finished().
+    if (error != QProcess::FailedToStart || this->process == nullptr)
+        return;
+
+    this->appendOutput(tr("Can't start the interpreter: %1\n")
+                       .arg(this->process->errorString()));
+    this->statusLabel->setText(tr("Interpreter not started"));
+    this->process->deleteLater();
+    this->process = nullptr;
+    this->setRunning(false);
+}
+
+void MainWindow::setRunning(bool running)
+{
+    this->runAction->setEnabled(!running);
+    this->stopAction->setEnabled(running);
+    this->progressBar->setVisible(running);
+    if (running) {
+        this->statusLabel->setText(tr("Running..."));
+        this->runTimer.start();
+    }
+}
+
+void MainWindow::setupStatusBar()
+{
+    this->statusLabel = new QLabel(this);
+    statusBar()->addWidget(this->statusLabel, 1);
+
+    // Busy indicator, since the length of a run isn't known in advance.
+    this->progressBar = new QProgressBar(this);
+    this->progressBar->setRange(0, 0);
+    this->progressBar->setMaximumWidth(160);
+    this->progressBar->setVisible(false);
+    statusBar()->addPermanentWidget(this->progressBar);
 }
 
 void MainWindow::setupFileMenu()
@@ -53,12 +53,18 @@
 
 #include "highlighter.h"
 
+#include <QElapsedTimer>
 #include <QMainWindow>
 #include <QVBoxLayout>
 #include <QPlainTextEdit>
+#include <QProcess>
 #include <QSpacerItem>
+#include <QTemporaryDir>
 
 QT_BEGIN_NAMESPACE
+class QAction;
+class QLabel;
+class QProgressBar;
 class QTextEdit;
 QT_END_NAMESPACE
 
@@ -75,12 +81,22 @@ public slots:
     void newFile();
     void openFile(const QString &path = QString());
     void run();
+    void stop();
+
+private slots:
+    void readOutput();
+    void readErrors();
+    void runFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void runFailed(QProcess::ProcessError error);
 
 private:
     void setupEditor(QWidget *parent);
     void setupFileMenu();
     void setupHelpMenu();
+    void setupStatusBar();
     void showErrors(const QString &err);
+    void appendOutput(const QString &text);
+    void setRunning(bool running);
 
     QTextEdit *editor;
     Highlighter *highlighter;
@@ -88,6 +104,23 @@ private:
     QVBoxLayout *vboxLayout;
     QPlainTextEdit *errWindow;
     QWidget *verticalWidget;
+
+    // Results of var statements of the last run, so that the next run
+    // executes only statements affected by the edits.
+    QTemporaryDir cacheDir;
+
+    // Interpreter of the current run, nullptr when nothing is running.
+    // Output is read as it arrives, so the editor isn't blocked.
+    QProcess *process;
+    QString stderrOutput;
+    int outputSize;
+    bool stopped;
+    QElapsedTimer runTimer;
+
+    QAction *runAction;
+    QAction *stopAction;
+    QProgressBar *progressBar;
+    QLabel *statusLabel;
 };
 //! [0]
 
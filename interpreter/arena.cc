@@ -0,0 +1,196 @@
+/* Bump allocator for objects that are freed all at once.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+
+/* Allocations are rounded up to this alignment, which is enough for any
+ * type.  */
+static const size_t alignment = 16;
+
+static size_t alignUp(size_t size) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * @brief Header placed before each object allocated by allocateObject(), so
+ * that freeObject() knows where the object came from.
+ */
+struct alignas(16) ObjectHeader {
+    bool inArena;
+    /* Free list the block goes back to, if not 0.  */
+    unsigned char sizeClass;
+};
+
+static thread_local Arena *currentArenas[Arena::kKindsCount];
+
+/* Objects allocated on the heap with headers up to this size are reused
+ * through free lists of the thread that frees them.  */
+static const size_t kMaxPooledSize = 128;
+static const int kSizeClassesCount = kMaxPooledSize / alignment;
+
+/* Longest free list, the rest of blocks go back to the heap, so that memory
+ * isn't piling up in a thread that only frees objects.  */
+static const int kMaxPooledBlocks = 1024;
+
+/**
+ * @brief Blocks of freed objects of each size class, kept for reuse by the
+ * same thread.
+ */
+struct FreeLists {
+    struct Node {
+        Node *next;
+    };
+
+    Node *heads[kSizeClassesCount + 1];
+    int counts[kSizeClassesCount + 1];
+
+    FreeLists() : heads(), counts() { }
+
+    ~FreeLists();
+};
+
+/* Objects can be freed after free lists of the thread are destroyed, those
+ * go to the heap.  */
+static thread_local bool freeListsDestroyed = false;
+static thread_local FreeLists freeLists;
+
+FreeLists::~FreeLists() {
+    for (auto &&head : this->heads) {
+        while (head != nullptr) {
+            auto next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+    freeListsDestroyed = true;
+}
+
+void Arena::freeBlocks(Block *block) {
+    while (block != nullptr) {
+        auto next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+Arena::~Arena() {
+    freeBlocks(this->blocks_);
+}
+
+void Arena::addBlock(size_t size) {
+    auto header = alignUp(sizeof(Block));
+    size = std::max(kBlockSize, header + size);
+    auto block = static_cast<Block*>(malloc(size));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    block->next = this->blocks_;
+    block->size = size;
+    this->blocks_ = block;
+    this->top_ = reinterpret_cast<char*>(block) + header;
+    this->end_ = reinterpret_cast<char*>(block) + size;
+}
+
+void *Arena::allocate(size_t size) {
+    size = alignUp(size);
+    if (size > static_cast<size_t>(this->end_ - this->top_)) {
+        this->addBlock(size);
+    }
+    void *p = this->top_;
+    this->top_ += size;
+    return p;
+}
+
+void Arena::reset() {
+    if (this->blocks_ == nullptr) {
+        return;
+    }
+    auto last = this->blocks_;
+    freeBlocks(last->next);
+    last->next = nullptr;
+    this->top_ = reinterpret_cast<char*>(last) + alignUp(sizeof(Block));
+    this->end_ = reinterpret_cast<char*>(last) + last->size;
+}
+
+Arena *Arena::getCurrent(Kind kind) {
+    return currentArenas[kind];
+}
+
+void *Arena::allocateObject(Kind kind, size_t size) {
+    auto arena = currentArenas[kind];
+    size = alignUp(size + sizeof(ObjectHeader));
+    ObjectHeader *header;
+    unsigned char sizeClass = 0;
+    if (arena != nullptr) {
+        header = static_cast<ObjectHeader*>(arena->allocate(size));
+    } else if (size <= kMaxPooledSize && !freeListsDestroyed) {
+        sizeClass = size / alignment;
+        auto &head = freeLists.heads[sizeClass];
+        if (head != nullptr) {
+            header = reinterpret_cast<ObjectHeader*>(head);
+            head = head->next;
+            freeLists.counts[sizeClass]--;
+        } else {
+            header = static_cast<ObjectHeader*>(::operator new(size));
+        }
+    } else {
+        header = static_cast<ObjectHeader*>(::operator new(size));
+    }
+    header->inArena = arena != nullptr;
+    header->sizeClass = sizeClass;
+    return header + 1;
+}
+
+void Arena::freeObject(void *p) {
+    if (p == nullptr) {
+        return;
+    }
+    auto header = static_cast<ObjectHeader*>(p) - 1;
+    if (header->inArena) {
+        return;
+    }
+    auto sizeClass = header->sizeClass;
+    if (sizeClass != 0 && !freeListsDestroyed &&
+            freeLists.counts[sizeClass] < kMaxPooledBlocks) {
+        auto node = reinterpret_cast<FreeLists::Node*>(header);
+        node->next = freeLists.heads[sizeClass];
+        freeLists.heads[sizeClass] = node;
+        freeLists.counts[sizeClass]++;
+        return;
+    }
+    ::operator delete(header);
+}
+
+bool Arena::inArena(const void *p) {
+    return (static_cast<const ObjectHeader*>(p) - 1)->inArena;
+}
+
+Arena::Use::Use(Kind kind, Arena *arena)
+        : kind_(kind), previous_(currentArenas[kind]) {
+    currentArenas[kind] = arena;
+}
+
+Arena::Use::~Use() {
+    currentArenas[this->kind_] = this->previous_;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
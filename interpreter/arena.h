@@ -0,0 +1,133 @@
+/* Bump allocator for objects that are freed all at once.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+/**
+ * @brief Memory taken from large blocks, that is freed all at once.
+ *
+ * Each thread can select an arena for each kind of objects.  Objects of
+ * classes derived from ArenaAllocated are then allocated in that arena, or
+ * on the heap if no arena is selected.  Deleting an object allocated in an
+ * arena only runs its destructor, memory is reclaimed by reset().  Small
+ * objects on the heap are recycled through free lists of each thread.
+ */
+class Arena {
+ public:
+    enum Kind {
+        /* Sequences created while a statement is executed.  */
+        kTemporaries,
+        kKindsCount,
+    };
+
+ private:
+    struct Block {
+        Block *next;
+        size_t size;
+    };
+
+    static const size_t kBlockSize = 64 * 1024;
+
+    /* Most recent block first.  */
+    Block *blocks_;
+    char *top_;
+    char *end_;
+
+    void addBlock(size_t size);
+
+    static void freeBlocks(Block *block);
+
+ public:
+    Arena() : blocks_(nullptr), top_(nullptr), end_(nullptr) { }
+
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena &operator=(const Arena&) = delete;
+
+    /**
+     * @brief Allocate memory aligned for any type.
+     */
+    void *allocate(size_t size);
+
+    /**
+     * @brief Free all memory allocated in the arena.  The most recent block
+     * is kept for reuse.
+     */
+    void reset();
+
+    /**
+     * @brief Get arena selected by this thread for objects of the kind.
+     * @returns nullptr if objects are allocated on the heap.
+     */
+    static Arena *getCurrent(Kind kind);
+
+    /**
+     * @brief Allocate an object in the current arena of the kind.
+     */
+    static void *allocateObject(Kind kind, size_t size);
+
+    /**
+     * @brief Free an object allocated by allocateObject().
+     */
+    static void freeObject(void *p);
+
+    /**
+     * @brief Check whether object was allocated in an arena.
+     */
+    static bool inArena(const void *p);
+
+    /**
+     * @brief Select arena for objects of the kind allocated by this thread,
+     * while this object exists.  nullptr selects the heap.
+     */
+    class Use {
+     private:
+        Kind kind_;
+        Arena *previous_;
+
+     public:
+        Use(Kind kind, Arena *arena);
+        ~Use();
+
+        Use(const Use&) = delete;
+        Use &operator=(const Use&) = delete;
+    };
+};
+
+/**
+ * @brief Base of classes, which objects are allocated in the current arena
+ * of the kind.
+ */
+template <Arena::Kind kind>
+class ArenaAllocated {
+ public:
+    static void *operator new(size_t size) {
+        return Arena::allocateObject(kind, size);
+    }
+
+    static void operator delete(void *p) {
+        Arena::freeObject(p);
+    }
+};
+
+#endif  // ARENA_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,165 @@
+/* Reductions of integer ranges computed with formulas.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "closedform.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/* Among more than this many consecutive terms of an affine function with
+ * integer coefficients there are at least 32 even ones, unless all of them
+ * are odd.  Product of such terms is 0 modulo 2^32.  */
+static const int maxProductTerms = 64;
+
+/**
+ * @brief Sum of integers in [first, last] modulo 2^64.
+ */
+static uint64_t sumOfRange(int64_t first, int64_t last) {
+    /* Either count or first + last is even, and it is halved before
+     * multiplication, so nothing is lost when the product wraps around.  */
+    int64_t count = last - first + 1;
+    if (count % 2 == 0) {
+        return static_cast<uint64_t>(count / 2) *
+               static_cast<uint64_t>(first + last);
+    }
+    return static_cast<uint64_t>(count) *
+           static_cast<uint64_t>((first + last) / 2);
+}
+
+std::unique_ptr<ClosedForm> ClosedForm::recognise(
+        const IntegerRangeValue &range, const Value &dflt,
+        const MapStages &stages, const Lambda &func) {
+    /* Size of a range wider than INT_MAX is not valid, such ranges are left
+     * to the general code.  */
+    if (dflt.isNone() || !dflt.isScalar() || range.getSize() <= 0) {
+        return nullptr;
+    }
+
+    bool floatParams[LinearForm::kMaxParams] = {
+        dflt.isScalarFloat(), false,
+    };
+    LinearForm form;
+    if (!func.getBody()->getLinearForm(floatParams, &form)) {
+        return nullptr;
+    }
+    if (!form.isProduct && form.coefficients[0] != 1) {
+        return nullptr;
+    }
+
+    std::unique_ptr<ClosedForm> result(new ClosedForm());
+    result->shape_ = form.isProduct ? kProduct : kSum;
+    result->isFloat_ = form.isFloat;
+    result->factor_ = 1;
+    result->offset_ = 0;
+    result->k_ = form.coefficients[1];
+    result->c_ = form.constant;
+    if (form.isProduct) {
+        result->name_ = "product";
+    } else if (result->k_ == 0 && result->c_ == 1) {
+        result->name_ = "count";
+    } else if (result->k_ == 1 && result->c_ == 0 && stages.empty()) {
+        result->name_ = "sum";
+    } else {
+        result->name_ = "affine sum";
+    }
+
+    if (!form.isFloat) {
+        /* Integer arithmetic wraps around, so affine stages are composed
+         * modulo 2^32 without any loss.  */
+        bool integerParams[LinearForm::kMaxParams] = { false, false };
+        for (auto &&stage : stages) {
+            LinearForm s;
+            if (!stage->getBody()->getLinearForm(integerParams, &s) ||
+                    s.isFloat || s.isProduct) {
+                return nullptr;
+            }
+            uint32_t a = s.coefficients[0], b = s.constant;
+            result->factor_ = a * result->factor_;
+            result->offset_ = a * result->offset_ + b;
+        }
+
+        uint32_t k = result->k_, c = result->c_;
+        uint32_t p = k * result->factor_, q = k * result->offset_ + c;
+        if (form.isProduct && range.getSize() > maxProductTerms &&
+                p % 2 == 0 && q % 2 == 1) {
+            return nullptr;
+        }
+        return result;
+    }
+
+    /* Floating point sum is exact only if every value it goes through is an
+     * integer that double can hold.  Magnitudes of element and accumulator
+     * give upper bounds of magnitudes of all sub-expressions.  */
+    if (form.isProduct || !stages.empty()) {
+        return nullptr;
+    }
+    auto d = dflt.asFloat();
+    if (d != std::trunc(d) || std::fabs(d) >= LinearForm::kMaxCoefficient ||
+            (d == 0 && std::signbit(d))) {
+        return nullptr;
+    }
+    double first = range.getFirst();
+    double last = first + range.getSize() - 1;
+    double params[LinearForm::kMaxParams];
+    params[1] = std::max(std::fabs(first), std::fabs(last));
+    params[0] = std::fabs(d) + range.getSize() *
+                (llabs(result->k_) * params[1] + llabs(result->c_));
+    if (params[0] >= LinearForm::kMaxCoefficient ||
+            form.getFloatBound(params) >= LinearForm::kMaxCoefficient ||
+            form.getIntegerBound(params) > std::numeric_limits<int>::max()) {
+        return nullptr;
+    }
+    return result;
+}
+
+Value ClosedForm::reduce(const IntegerRangeValue &range, int begin, int end,
+                         const Value &dflt) const {
+    int64_t count = end - begin;
+    int64_t first = static_cast<int64_t>(range.getFirst()) + begin;
+    int64_t last = first + count - 1;
+
+    if (this->isFloat_) {
+        /* Bounds checked by recognise() guarantee that this doesn't
+         * overflow.  */
+        auto sum = static_cast<int64_t>(sumOfRange(first, last));
+        auto d = static_cast<int64_t>(dflt.asFloat());
+        return Value(static_cast<double>(d + this->k_ * sum +
+                                         this->c_ * count));
+    }
+
+    /* Lambda gets p * x + q for each element x.  */
+    uint32_t k = this->k_, c = this->c_;
+    uint32_t p = k * this->factor_, q = k * this->offset_ + c;
+    uint32_t result = dflt.asInteger();
+    if (this->shape_ == kProduct) {
+        if (count > maxProductTerms) {
+            return Value(0);
+        }
+        for (auto x = first; x <= last; x++) {
+            result *= p * static_cast<uint32_t>(x) + q;
+        }
+    } else {
+        result += p * static_cast<uint32_t>(sumOfRange(first, last)) +
+                  q * static_cast<uint32_t>(count);
+    }
+    return Value(static_cast<int>(result));
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
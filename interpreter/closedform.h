@@ -0,0 +1,90 @@
+/* Reductions of integer ranges computed with formulas.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLOSEDFORM_H_
+#define CLOSEDFORM_H_
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "expression.h"
+#include "linearform.h"
+#include "value.h"
+
+/**
+ * @brief Reduction of an integer range that is computed in constant time,
+ * without calling the lambda for each element.
+ *
+ * Recognised reductions are sums, where lambda adds to the accumulator an
+ * affine function of the element, like `a + b' or `a + 2 * b + 1', and
+ * products `a * b'.  Map stages fused into the reduce are allowed if they are
+ * affine functions too.  Integer results wrap around exactly like the element
+ * by element evaluation.  Floating point sums are computed only if all
+ * intermediate values are integers that are exactly representable, otherwise
+ * rounding would make results different.
+ */
+class ClosedForm {
+ private:
+    enum Shape {
+        kSum,
+        kProduct,
+    };
+
+    Shape shape_;
+    const char *name_;
+    bool isFloat_;
+    /* Elements are passed to lambda as factor * x + offset.  */
+    uint32_t factor_;
+    uint32_t offset_;
+    /* Lambda is acc + k * element + c or acc * (k * element + c).  */
+    int64_t k_;
+    int64_t c_;
+
+    ClosedForm() { }
+
+ public:
+    /**
+     * @brief Recognise reduction of a range.
+     *
+     * @param stages Map stages fused into the reduction.
+     * @param func Reduction lambda.
+     * @returns nullptr if reduction is not recognised, or if its result
+     * can't be computed exactly for this range and default value.
+     */
+    static std::unique_ptr<ClosedForm> recognise(
+        const IntegerRangeValue &range, const Value &dflt,
+        const MapStages &stages, const Lambda &func);
+
+    /**
+     * @brief Reduce slice [begin, end) of the range, starting with given
+     * value of accumulator.
+     */
+    Value reduce(const IntegerRangeValue &range, int begin, int end,
+                 const Value &dflt) const;
+
+    /**
+     * @brief Name of the formula, like "sum" or "product".
+     */
+    const char *getName() const {
+        return this->name_;
+    }
+};
+
+#endif  // CLOSEDFORM_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,88 @@
+/* Contiguous storage of numeric vector elements.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "column.h"
+
+void Column::convertToFloat() {
+    this->floats_.reserve(this->integers_.capacity());
+    this->floats_.append(this->integers_.begin(), this->integers_.end());
+    this->integers_.clear();
+    this->type_ = kFloat;
+}
+
+void Column::reserve(int size) {
+    if (this->type_ == kInteger) {
+        this->integers_.reserve(size);
+    } else {
+        this->floats_.reserve(size);
+    }
+}
+
+void Column::resize(int size) {
+    if (this->type_ == kInteger) {
+        this->integers_.resize(size);
+    } else {
+        this->floats_.resize(size);
+    }
+}
+
+std::string Column::getString(int index) const {
+    if (this->type_ == kInteger) {
+        return std::to_string(this->integers_[index]);
+    } else {
+        return std::to_string(this->floats_[index]);
+    }
+}
+
+Column Column::join(const std::vector<Column> &parts) {
+    Type type = kInteger;
+    int size = 0;
+    for (auto &&part : parts) {
+        if (part.isFloat()) {
+            type = kFloat;
+        }
+        size += part.getSize();
+    }
+
+    Column result(type);
+    result.reserve(size);
+    /* Parts are copied in blocks, so that blocks of spilled columns can be
+     * released as soon as they are copied.  */
+    int blockSize = Spill::kBlockSize / sizeof(double);
+    for (auto &&part : parts) {
+        auto partSize = part.getSize();
+        for (int begin = 0; begin < partSize; begin += blockSize) {
+            auto end = std::min(partSize, begin + blockSize);
+            if (type == kInteger) {
+                result.integers_.append(part.integers_.begin() + begin,
+                                        part.integers_.begin() + end);
+            } else if (part.isFloat()) {
+                result.floats_.append(part.floats_.begin() + begin,
+                                      part.floats_.begin() + end);
+            } else {
+                result.floats_.append(part.integers_.begin() + begin,
+                                      part.integers_.begin() + end);
+            }
+            if (part.isSpilled()) {
+                part.release(begin, end);
+            }
+        }
+    }
+    return result;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,366 @@
+/* Contiguous storage of numeric vector elements.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLUMN_H_
+#define COLUMN_H_
+
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "spill.h"
+
+/**
+ * @brief Growable array of elements of a column, allocated by Spill.
+ *
+ * Works like std::vector for trivial types, but array can be placed in a
+ * spill file.  Blocks of a spilled array are released from memory as soon as
+ * they are filled by push_back().
+ */
+template <typename T>
+class ColumnBuffer {
+ private:
+    T *data_;
+    size_t size_;
+    size_t capacity_;
+    bool spilled_;
+    /* Elements before this one have been released from memory.  */
+    size_t released_;
+
+    void reallocate(size_t capacity) {
+        bool spilled;
+        auto data = static_cast<T*>(Spill::allocate(capacity * sizeof(T),
+                                                    &spilled));
+        if (this->size_ > 0) {
+            memcpy(data, this->data_, this->size_ * sizeof(T));
+        }
+        this->deallocate();
+        this->data_ = data;
+        this->capacity_ = capacity;
+        this->spilled_ = spilled;
+        this->released_ = 0;
+    }
+
+    void deallocate() {
+        if (this->data_ != nullptr) {
+            Spill::free(this->data_, this->capacity_ * sizeof(T),
+                        this->spilled_);
+        }
+    }
+
+    void releaseFilled() {
+        auto filled = this->size_ - this->released_;
+        if (filled * sizeof(T) >= Spill::kBlockSize) {
+            Spill::release(this->data_ + this->released_, filled * sizeof(T));
+            this->released_ = this->size_;
+        }
+    }
+
+ public:
+    ColumnBuffer()
+        : data_(nullptr), size_(0), capacity_(0), spilled_(false),
+          released_(0) { }
+
+    ColumnBuffer(ColumnBuffer &&other) noexcept : ColumnBuffer() {
+        this->swap(&other);
+    }
+
+    ColumnBuffer &operator=(ColumnBuffer &&other) noexcept {
+        this->swap(&other);
+        return *this;
+    }
+
+    ColumnBuffer(const ColumnBuffer&) = delete;
+    ColumnBuffer &operator=(const ColumnBuffer&) = delete;
+
+    ~ColumnBuffer() {
+        this->deallocate();
+    }
+
+    void swap(ColumnBuffer *other) {
+        std::swap(this->data_, other->data_);
+        std::swap(this->size_, other->size_);
+        std::swap(this->capacity_, other->capacity_);
+        std::swap(this->spilled_, other->spilled_);
+        std::swap(this->released_, other->released_);
+    }
+
+    size_t size() const {
+        return this->size_;
+    }
+
+    size_t capacity() const {
+        return this->capacity_;
+    }
+
+    bool isSpilled() const {
+        return this->spilled_;
+    }
+
+    T *data() {
+        return this->data_;
+    }
+
+    const T *data() const {
+        return this->data_;
+    }
+
+    const T *begin() const {
+        return this->data_;
+    }
+
+    const T *end() const {
+        return this->data_ + this->size_;
+    }
+
+    const T &operator[](size_t index) const {
+        return this->data_[index];
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity > this->capacity_) {
+            this->reallocate(capacity);
+        }
+    }
+
+    /**
+     * @brief Change number of elements, new elements are zeroes.  Spilled
+     * arrays are zeroes already, since buffers never shrink.
+     */
+    void resize(size_t size) {
+        this->reserve(size);
+        if (size > this->size_ && !this->spilled_) {
+            memset(this->data_ + this->size_, 0,
+                   (size - this->size_) * sizeof(T));
+        }
+        this->size_ = size;
+    }
+
+    void push_back(T value) {
+        if (this->size_ == this->capacity_) {
+            this->reallocate(std::max<size_t>(16, this->capacity_ * 2));
+        }
+        this->data_[this->size_++] = value;
+        if (this->spilled_) {
+            this->releaseFilled();
+        }
+    }
+
+    /**
+     * @brief Append elements of another array, converting them to T.
+     */
+    template <typename Source>
+    void append(const Source *first, const Source *last) {
+        this->reserve(this->size_ + (last - first));
+        std::copy(first, last, this->data_ + this->size_);
+        this->size_ += last - first;
+        if (this->spilled_) {
+            this->releaseFilled();
+        }
+    }
+
+    /**
+     * @brief Take an array mapped from a file.  It is treated as a spilled
+     * one and is unmapped by Spill::free().
+     */
+    void adopt(T *data, size_t size) {
+        this->deallocate();
+        this->data_ = data;
+        this->size_ = size;
+        this->capacity_ = size;
+        this->spilled_ = true;
+        this->released_ = 0;
+    }
+
+    /**
+     * @brief Remove all elements and free the array.
+     */
+    void clear() {
+        ColumnBuffer().swap(this);
+    }
+};
+
+/**
+ * @brief Elements of a vector stored unboxed in a single contiguous array.
+ *
+ * All elements of a column have the same type, which is described by a single
+ * type tag, so a vector of N integers takes exactly N * sizeof(int) bytes
+ * instead of N separately allocated scalar values.  Only one of the two
+ * arrays is used at any time.
+ */
+class Column {
+ public:
+    enum Type {
+        kInteger,
+        kFloat,
+    };
+
+ private:
+    Type type_;
+    ColumnBuffer<int> integers_;
+    ColumnBuffer<double> floats_;
+
+    /**
+     * @brief Convert all elements stored so far to floating point type.
+     */
+    void convertToFloat();
+
+ public:
+    explicit Column(Type type = kInteger) : type_(type) { }
+
+    Type getType() const {
+        return this->type_;
+    }
+
+    bool isFloat() const {
+        return this->type_ == kFloat;
+    }
+
+    /**
+     * @brief Whether elements are stored in a spill file.
+     */
+    bool isSpilled() const {
+        return this->integers_.isSpilled() || this->floats_.isSpilled();
+    }
+
+    /**
+     * @brief Drop elements [begin, end) of a spilled column from memory,
+     * they are read from the file when accessed again.
+     */
+    void release(int begin, int end) const {
+        if (this->type_ == kInteger) {
+            Spill::release(this->integers_.data() + begin,
+                           (end - begin) * sizeof(int));
+        } else {
+            Spill::release(this->floats_.data() + begin,
+                           (end - begin) * sizeof(double));
+        }
+    }
+
+    int getSize() const {
+        if (this->type_ == kInteger) {
+            return this->integers_.size();
+        } else {
+            return this->floats_.size();
+        }
+    }
+
+    void reserve(int size);
+
+    /**
+     * @brief Bytes allocated for elements, including unused capacity.
+     */
+    size_t getMemoryUsage() const {
+        return this->integers_.capacity() * sizeof(int) +
+               this->floats_.capacity() * sizeof(double);
+    }
+
+    /**
+     * @brief Change number of elements, new elements are zeroes.
+     */
+    void resize(int size);
+
+    int getInteger(int index) const {
+        if (this->type_ == kInteger) {
+            return this->integers_[index];
+        } else {
+            return static_cast<int>(this->floats_[index]);
+        }
+    }
+
+    double getFloat(int index) const {
+        if (this->type_ == kInteger) {
+            return static_cast<double>(this->integers_[index]);
+        } else {
+            return this->floats_[index];
+        }
+    }
+
+    /**
+     * @brief Get string representation of an element.  Format is the same as
+     * for the scalar values.
+     */
+    std::string getString(int index) const;
+
+    /**
+     * @brief Append an integer element.  If column already stores floating
+     * point numbers, then value is converted to a float.
+     */
+    void pushInteger(int v) {
+        if (this->type_ == kInteger) {
+            this->integers_.push_back(v);
+        } else {
+            this->floats_.push_back(static_cast<double>(v));
+        }
+    }
+
+    /**
+     * @brief Append a floating point element.  If column stores integers, all
+     * of them are converted to floats first, because column can have only a
+     * single type.
+     */
+    void pushFloat(double v) {
+        if (this->type_ == kInteger) {
+            this->convertToFloat();
+        }
+        this->floats_.push_back(v);
+    }
+
+    const int *getIntegers() const {
+        return this->integers_.data();
+    }
+
+    int *getIntegers() {
+        return this->integers_.data();
+    }
+
+    const double *getFloats() const {
+        return this->floats_.data();
+    }
+
+    double *getFloats() {
+        return this->floats_.data();
+    }
+
+    /**
+     * @brief Use elements mapped from a file without copying them.  Mapping
+     * should be writable, it is unmapped when the column is destroyed.
+     */
+    void adopt(Type type, void *data, int size) {
+        this->type_ = type;
+        if (type == kInteger) {
+            this->integers_.adopt(static_cast<int*>(data), size);
+        } else {
+            this->floats_.adopt(static_cast<double*>(data), size);
+        }
+    }
+
+    /**
+     * @brief Concatenate several columns into one.
+     *
+     * Result has floating point type if any of the parts has it.
+     */
+    static Column join(const std::vector<Column> &parts);
+};
+
+#endif  // COLUMN_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -19,17 +19,55 @@
 #include <sstream>
 #include <stdexcept>
 
-void Context::setVariable(const std::string &name, ValuePtr value) {
-    this->variables_[name] = value;
+void Scope::unknownIdentifier(const std::string &name) {
+    std::stringstream s;
+    s << "Unknown identifier: " << name;
+    throw std::out_of_range(s.str().c_str());
 }
 
-ValuePtr Context::getVariable(const std::string &name) {
-    if (this->variables_.count(name) == 0) {
-        std::stringstream s;
-        s << "Unknown identifier: " << name;
-        throw std::out_of_range(s.str().c_str());
+Scope::Kind Scope::kindOf(const Value &value) {
+    if (value.isNone() || !value.isScalar()) {
+        return kUnknown;
     }
-    return this->variables_[name];
+    return value.isScalarFloat() ? kFloat : kInteger;
+}
+
+int Context::declareVariable(const std::string &name) {
+    auto it = this->slots_.find(name);
+    if (it != this->slots_.end()) {
+        return it->second;
+    }
+
+    int slot = this->variables_.size();
+    this->slots_.emplace(name, slot);
+    this->variables_.emplace_back();
+    return slot;
+}
+
+bool Context::findLargestVariable(std::string *name, size_t *bytes) const {
+    *bytes = 0;
+    for (auto &&slot : this->slots_) {
+        auto usage = this->variables_[slot.second].getMemoryUsage();
+        if (usage > *bytes || (usage == *bytes && usage > 0 &&
+                               slot.first < *name)) {
+            *name = slot.first;
+            *bytes = usage;
+        }
+    }
+    return *bytes > 0;
+}
+
+int Context::find(const std::string &name) const {
+    auto it = this->slots_.find(name);
+    return it == this->slots_.end() ? -1 : it->second;
+}
+
+int Context::resolve(const std::string &name) const {
+    auto it = this->slots_.find(name);
+    if (it == this->slots_.end()) {
+        unknownIdentifier(name);
+    }
+    return it->second;
 }
 
 // vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
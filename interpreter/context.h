@@ -20,21 +20,100 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "value.h"
 
+/**
+ * @brief Names visible to an expression.
+ *
+ * Identifiers are resolved to slots once, before the expression is
+ * evaluated, so evaluation reads variables by index without looking up
+ * names.
+ */
+class Scope {
+ public:
+    /**
+     * @brief What is known about a value before expression is evaluated.
+     */
+    enum Kind {
+        kUnknown,
+        kScalar,
+        kInteger,
+        kFloat,
+    };
+
+    virtual ~Scope() { }
+
+    /**
+     * @brief Get slot of a variable.
+     * @throws std::out_of_range if name is unknown.
+     */
+    virtual int resolve(const std::string &name) const = 0;
+
+    /**
+     * @brief Get what is known about value of a variable in the slot.
+     */
+    virtual Kind getKind(int slot) const = 0;
+
+    static Kind kindOf(const Value &value);
+
+    /**
+     * @brief Throw an error about an unknown identifier.
+     */
+    static void unknownIdentifier(const std::string &name);
+};
+
 /**
  * @brief Program context
+ *
+ * Variables are stored in a flat array of slots.  For the top level program
+ * the slot of each variable is assigned when its `var' statement is
+ * resolved.  Contexts of lambdas have a slot per parameter.
  */
-class Context {
+class Context : public Scope {
  private:
-    std::unordered_map<std::string, ValuePtr> variables_;
+    std::unordered_map<std::string, int> slots_;
+    std::vector<Value> variables_;
 
  public:
-    Context() : variables_() { }
+    Context() : slots_(), variables_() { }
+
+    explicit Context(int slotsCount) : slots_(), variables_(slotsCount) { }
+
+    /**
+     * @brief Get a slot for a variable, creating it on the first declaration.
+     */
+    int declareVariable(const std::string &name);
+
+    virtual int resolve(const std::string &name) const;
+
+    /**
+     * @brief Get slot of a variable, or -1 if it hasn't been declared.
+     */
+    int find(const std::string &name) const;
+
+    /**
+     * @brief Variables are resolved right before the statement is executed,
+     * so their current values are the ones the statement will see.
+     */
+    virtual Kind getKind(int slot) const {
+        return kindOf(this->variables_[slot]);
+    }
+
+    void setVariable(int slot, const Value &value) {
+        this->variables_[slot] = value;
+    }
+
+    const Value &getVariable(int slot) const {
+        return this->variables_[slot];
+    }
 
-    void setVariable(const std::string &name, ValuePtr value);
-    ValuePtr getVariable(const std::string &name);
+    /**
+     * @brief Find variable whose value holds the most memory.
+     * @returns false if no variable holds any.
+     */
+    bool findLargestVariable(std::string *name, size_t *bytes) const;
 };
 
 #endif  // CONTEXT_H_
@@ -17,17 +17,56 @@
 
 #include "error.h"
 
+#include <sstream>
+
+#include "output.h"
+
+/* Set while an ErrorCapture of this thread exists.  */
+static thread_local std::string *capturedErrors = nullptr;
+
+static void report(const std::string &text) {
+    if (capturedErrors != nullptr) {
+        capturedErrors->append(text);
+    } else {
+        Output::get().writeError(text);
+    }
+}
+
 int user_error(const YYLTYPE *loc, const std::string &msg) {
-    std::cerr << "ERROR:" << loc->first_line << "," << loc->first_column;
+    std::stringstream s;
+    s << "ERROR:" << loc->first_line << "," << loc->first_column;
     if (loc->first_line != loc->last_line
             || loc->first_column != loc->last_column) {
-        std::cerr << "-" << loc->last_line << "," << loc->last_column;
+        s << "-" << loc->last_line << "," << loc->last_column;
     }
-    std::cerr << ":" << msg << std::endl;
+    s << ":" << msg << std::endl;
+    report(s.str());
+    return 0;
 }
 
 int user_error(int line, const std::string &msg) {
-    std::cerr << "ERROR:" << line << ":" << msg << std::endl;
+    std::stringstream s;
+    s << "ERROR:" << line << ":" << msg << std::endl;
+    report(s.str());
+    return 0;
+}
+
+ErrorCapture::ErrorCapture() : text_(), previous_(capturedErrors) {
+    capturedErrors = &this->text_;
+}
+
+ErrorCapture::~ErrorCapture() {
+    capturedErrors = this->previous_;
+}
+
+std::string ErrorCapture::take() {
+    std::string text;
+    text.swap(this->text_);
+    return text;
+}
+
+void ErrorCapture::replay(const std::string &text) {
+    report(text);
 }
 
 // vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -43,4 +43,34 @@ int user_error(const YYLTYPE *loc, const std::string &msg);
  */
 int user_error(int line, const std::string &msg);
 
+/**
+ * @brief Collect errors reported by the current thread instead of printing
+ * them, while the object exists.
+ *
+ * Lines parsed ahead of execution keep their errors until execution reaches
+ * them, so errors are printed at the same place of the output.
+ */
+class ErrorCapture {
+ private:
+    std::string text_;
+    std::string *previous_;
+
+ public:
+    ErrorCapture();
+    ~ErrorCapture();
+
+    ErrorCapture(const ErrorCapture&) = delete;
+    ErrorCapture &operator=(const ErrorCapture&) = delete;
+
+    /**
+     * @brief Get errors collected so far and clear them.
+     */
+    std::string take();
+
+    /**
+     * @brief Report errors collected by a capture.
+     */
+    static void replay(const std::string &text);
+};
+
 #endif  // ERROR_H_
@@ -17,148 +17,1172 @@
 
 #include "expression.h"
 
+#include <stdint.h>
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "closedform.h"
+#include "jit.h"
+#include "options.h"
+#include "output.h"
+#include "threadpool.h"
+#include "vectorfile.h"
+#include "vm.h"
+
 /**
- * If input vector is lesser than this size size, then map/reduce will be done
- * in the main thread, without concurrency.  */
+ * If input vector is lesser than this size size, then map will be done in the
+ * main thread, without concurrency.  */
 static const int multithreadingThreshold = 32;
 
-std::vector<ValuePtr> MapExpression::getResult(
-    ValuePtr input, const std::string &paramName,
-    std::shared_ptr<const Expression> func) {
+/**
+ * @brief Split input into as many slices as there are threads in the pool.
+ * @returns number of slices, never larger than the input.
+ */
+static int getSlicesCount(int inputSize) {
+    return std::min(inputSize, ThreadPool::get().getThreadsCount());
+}
+
+/**
+ * @brief Get bounds of a slice.  Last slice gets the remainder, in case
+ * input size doesn't divide evenly.
+ */
+static void getSliceBounds(int inputSize, int slicesCount, int slice,
+                           int *begin, int *end) {
+    auto sliceSize = inputSize / slicesCount;
+    *begin = slice * sliceSize;
+    *end = (slice == slicesCount - 1) ? inputSize : *begin + sliceSize;
+}
+
+/**
+ * @brief Calls of map stages made by a single thread.  Each stage is applied
+ * to the result of the previous one.
+ */
+class StagesCall {
+ private:
+    std::vector<LambdaCall> calls_;
 
-    std::vector<ValuePtr> seq;
-    seq.reserve(input->getSize());
-    Context funcCtx;
-    for (; !input->isNone(); input = input->next()) {
-        funcCtx.setVariable(paramName, input->asScalar());
-        auto newValue = func->evaluate(&funcCtx);
+ public:
+    StagesCall(MapStages::const_iterator first,
+               MapStages::const_iterator last) {
+        for (; first != last; ++first) {
+            this->calls_.emplace_back(**first);
+        }
+    }
 
-        if (!newValue->isScalar()) {
-            auto msg = "Can't return vector value as result of lambda function.";
-            throw std::invalid_argument(msg);
+    Value call(Value item) {
+        for (auto &&call : this->calls_) {
+            item = call.call(&item);
+            if (!item.isScalar()) {
+                auto msg = "Can't return vector value as result of lambda "
+                           "function.";
+                throw std::invalid_argument(msg);
+            }
         }
+        return item;
+    }
+};
 
-        seq.push_back(newValue);
+/**
+ * @brief Check whether stages can be fused for the input.
+ *
+ * Without fusion, results of a stage are stored in a Column, which makes all
+ * of them float if any of them is float, and errors of a stage are reported
+ * before any errors of the next one.  Fused stages give the same results and
+ * errors only if every stage is arithmetic on its parameter, which can't
+ * fail and gives values of a single type.
+ */
+static bool canFuse(const Value &input, MapStages::const_iterator first,
+                    MapStages::const_iterator last) {
+    bool isFloat = input.getSequence()->isFloat();
+    for (; first != last; ++first) {
+        bool param = isFloat;
+        if (!(*first)->getBody()->getScalarType(&param, &isFloat)) {
+            return false;
+        }
     }
+    return true;
+}
+
+/**
+ * @brief Pass slice of input through map stages.
+ */
+static Column mapSlice(const Value &input, int begin, int end,
+                       MapStages::const_iterator first,
+                       MapStages::const_iterator last) {
+    Column seq;
+    seq.reserve(end - begin);
+    StagesCall stages(first, last);
+    input.forEachChunk(begin, end, [&](const Chunk &chunk) {
+        for (int i = 0; i < chunk.size; i++) {
+            auto newValue = stages.call(chunk.getItem(i));
+            if (newValue.isScalarFloat()) {
+                seq.pushFloat(newValue.asFloat());
+            } else {
+                seq.pushInteger(newValue.asInteger());
+            }
+        }
+    });
     return seq;
 }
 
-ValuePtr MapExpression::evaluate(Context *ctx) const {
-    auto inputVal = this->input_->evaluate(ctx);
+/**
+ * @brief Pass input through map stages.  Several stages are fused only if
+ * canFuse() allows it.
+ */
+static Value mapSequence(const Value &input, MapStages::const_iterator first,
+                         MapStages::const_iterator last) {
+    auto inputSize = input.getSize();
+    auto slicesCount = inputSize < multithreadingThreshold
+                       ? 1 : getSlicesCount(inputSize);
+    std::vector<Column> slices(slicesCount);
+    ThreadPool::get().parallelFor(slicesCount, [&](int slice) {
+        int begin, end;
+        getSliceBounds(inputSize, slicesCount, slice, &begin, &end);
+        slices[slice] = mapSlice(input, begin, end, first, last);
+    });
+
+    if (slicesCount == 1) {
+        return Value(new VectorValue(new Column(std::move(slices[0]))));
+    }
+    return Value(new VectorValue(new Column(Column::join(slices))));
+}
+
+/**
+ * @brief Scope of a lambda body: only lambda parameters are visible.
+ */
+class LambdaScope : public Scope {
+ private:
+    const std::vector<std::string> &params_;
+    const std::vector<Kind> &kinds_;
+
+ public:
+    LambdaScope(const std::vector<std::string> &params,
+                const std::vector<Kind> &kinds)
+        : params_(params), kinds_(kinds) {
+    }
+
+    virtual int resolve(const std::string &name) const {
+        /* If several parameters have the same name, the last one wins, just
+         * like when they were assigned to context one after another.  */
+        for (int i = this->params_.size() - 1; i >= 0; i--) {
+            if (this->params_[i] == name) {
+                return i;
+            }
+        }
+        unknownIdentifier(name);
+        return -1;
+    }
+
+    virtual Kind getKind(int slot) const {
+        return this->kinds_[slot];
+    }
+};
+
+/**
+ * @brief Start a line of expression dump.
+ */
+static std::ostream &indented(std::ostream *out, int indent) {
+    return *out << std::string(indent * 2, ' ');
+}
+
+/**
+ * @brief Get value of expression if it is a scalar constant.
+ * @returns nullptr if it is not.
+ */
+static const Value *getConstant(const Expression &expr) {
+    auto valueExpr = dynamic_cast<const ValueExpression*>(&expr);
+    if (valueExpr == nullptr) {
+        return nullptr;
+    }
+    auto &value = valueExpr->getValue();
+    if (value.isNone() || !value.isScalar()) {
+        return nullptr;
+    }
+    return &value;
+}
+
+static bool isIntegerConstant(const Expression &expr, int value) {
+    auto constant = getConstant(expr);
+    return constant != nullptr && !constant->isScalarFloat() &&
+           constant->asInteger() == value;
+}
+
+static bool isScalar(const Expression &expr) {
+    return expr.getKind() != Scope::kUnknown;
+}
+
+/**
+ * @brief Evaluate operation on constant operands.
+ * @returns New expression with the result, or nullptr if operands are not
+ * constants or operation fails, in which case it will fail at run time.
+ */
+static Expression *fold(const Expression &left, const Expression &right,
+                        Value (Value::*op)(const Value &r) const) {
+    auto l = getConstant(left);
+    auto r = getConstant(right);
+    if (l == nullptr || r == nullptr) {
+        return nullptr;
+    }
+
+    try {
+        return new ValueExpression((l->*op)(*r));
+    } catch (std::exception &) {
+        return nullptr;
+    }
+}
+
+/**
+ * @brief Delete expression and return its replacement.  Replacement that
+ * was created by optimizer takes location of the expression.
+ */
+static Expression *replace(Expression *expr, Expression *replacement) {
+    if (replacement->getLine() == 0) {
+        replacement->setLocation(expr->getLine(), expr->getColumn());
+    }
+    delete expr;
+    return replacement;
+}
+
+/**
+ * @brief Arithmetic operation on scalars gives a scalar, which is an integer
+ * only if both operands are.  If any operand can be a vector, then result can
+ * be a vector too.
+ */
+static Scope::Kind getArithmeticKind(const Expression &left,
+                                     const Expression &right) {
+    auto l = left.getKind(), r = right.getKind();
+    if (l == Scope::kUnknown || r == Scope::kUnknown) {
+        return Scope::kUnknown;
+    }
+    if (l == Scope::kFloat || r == Scope::kFloat) {
+        return Scope::kFloat;
+    }
+    if (l == Scope::kInteger && r == Scope::kInteger) {
+        return Scope::kInteger;
+    }
+    return Scope::kScalar;
+}
+
+/**
+ * @brief Type of arithmetic operation on scalars, which is a float if any
+ * operand is.
+ */
+static bool getArithmeticType(const Expression &left,
+                              const Expression &right,
+                              const bool *floatParams, bool *isFloat) {
+    bool l, r;
+    if (!left.getScalarType(floatParams, &l) ||
+            !right.getScalarType(floatParams, &r)) {
+        return false;
+    }
+    *isFloat = l || r;
+    return true;
+}
+
+/**
+ * @brief Check whether expression is the accumulator variable itself, or
+ * updates it in the given way.
+ */
+static bool isAccumulator(const Expression &expr, int slot,
+                          Accumulation accumulation) {
+    if (dynamic_cast<const IdentifierExpression*>(&expr) != nullptr) {
+        return expr.readsVariable(slot);
+    }
+    return expr.getAccumulation(slot) == accumulation;
+}
+
+/**
+ * @brief Check whether `acc op term' accumulates in the given way.
+ */
+static bool accumulates(const Expression &acc, const Expression &term,
+                        int slot, Accumulation accumulation) {
+    return isAccumulator(acc, slot, accumulation) &&
+           !term.readsVariable(slot);
+}
+
+Expression *Expression::profile(int depth, Profile::Clock clock) {
+    auto site = Profile::get().addSite(this->line_, this->column_, depth,
+                                       this->getName(), clock);
+    this->profileChildren(depth + 1, clock);
+    return new ProfiledExpression(this, site);
+}
+
+Lambda::Lambda(const std::vector<std::string> &params, Expression *body)
+    : params_(params), body_(body), site_(nullptr) {
+}
+
+/* Destructor is defined here, where Bytecode is a complete type.  */
+Lambda::~Lambda() {
+}
+
+void Lambda::resolve(const std::vector<Scope::Kind> &kinds) {
+    this->body_->resolve(LambdaScope(this->params_, kinds));
+}
+
+void Lambda::profile(int depth) {
+    std::string name = "Lambda";
+    for (auto &&param : this->params_) {
+        name += " " + param;
+    }
+    this->site_ = Profile::get().addSite(this->body_->getLine(),
+                                         this->body_->getColumn(), depth,
+                                         name, Profile::kWallClock);
+    Expression::profileChild(&this->body_, depth + 1, Profile::kWallClock);
+}
+
+const Bytecode *Lambda::getBytecode() const {
+    std::call_once(this->compileFlag_, [this]() {
+        Compiler compiler(this->params_.size());
+        this->code_ = compiler.compile(this->body_.get());
+    });
+    return this->code_.get();
+}
+
+const JitCode *Lambda::getJitCode(unsigned floatParams) const {
+    std::call_once(this->jitFlags_[floatParams], [this, floatParams]() {
+        this->jitCode_[floatParams] = JitCode::compile(
+            *this->getBytecode(), this->params_.size(), floatParams);
+    });
+    return this->jitCode_[floatParams].get();
+}
+
+void Lambda::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Lambda";
+    for (auto &&param : this->params_) {
+        *out << " " << param;
+    }
+    *out << std::endl;
+    this->body_->dump(out, indent + 1);
+}
+
+LambdaCall::LambdaCall(const Lambda &lambda)
+    : lambda_(lambda), code_(nullptr), ctx_(lambda.getParams().size()),
+      useJit_(false), jitCode_(), jitFetched_() {
+    if (Options::get().engine == Options::kBytecode) {
+        this->code_ = lambda.getBytecode();
+        this->registers_.resize(this->code_->getRegistersCount());
+    }
+    if (Options::get().jit &&
+            lambda.getParams().size() <= Lambda::kMaxJitParams) {
+        this->useJit_ = true;
+        this->slots_.resize(lambda.getBytecode()->getRegistersCount());
+    }
+}
+
+bool LambdaCall::callJit(const Value *args, Value *result) {
+    auto paramsCount = this->lambda_.getParams().size();
+    unsigned floatParams = 0;
+    for (size_t i = 0; i < paramsCount; i++) {
+        if (args[i].isNone() || !args[i].isScalar()) {
+            return false;
+        }
+        if (args[i].isScalarFloat()) {
+            floatParams |= 1u << i;
+        }
+    }
+
+    if (!this->jitFetched_[floatParams]) {
+        this->jitCode_[floatParams] = this->lambda_.getJitCode(floatParams);
+        this->jitFetched_[floatParams] = true;
+    }
+    auto code = this->jitCode_[floatParams];
+    if (code == nullptr) {
+        return false;
+    }
+
+    for (size_t i = 0; i < paramsCount; i++) {
+        JitCode::setSlot(this->slots_.data(), i, args[i]);
+    }
+    return code->run(this->slots_.data(), result);
+}
+
+/**
+ * @brief Evaluate lambda body and count the call in the profile.  Profiled
+ * programs are always walked, so timer is needed only there, and is kept
+ * off the common path.
+ */
+static Value __attribute__((noinline)) evaluateProfiled(const Lambda &lambda,
+                                                        Context *ctx) {
+    Profile::Timer timer(lambda.getSite());
+    return lambda.getBody()->evaluate(ctx);
+}
+
+Value LambdaCall::call(const Value *args) {
+    Value result;
+    if (this->useJit_ && this->callJit(args, &result)) {
+        return result;
+    }
+
+    auto paramsCount = this->lambda_.getParams().size();
+    if (this->code_ != nullptr) {
+        std::copy(args, args + paramsCount, this->registers_.begin());
+        return this->code_->run(&this->ctx_, this->registers_.data());
+    }
+
+    for (size_t i = 0; i < paramsCount; i++) {
+        this->ctx_.setVariable(i, args[i]);
+    }
+    if (this->lambda_.getSite() != nullptr) {
+        return evaluateProfiled(this->lambda_, &this->ctx_);
+    }
+    return this->lambda_.getBody()->evaluate(&this->ctx_);
+}
+
+Expression *AddExpression::optimize() {
+    optimizeChild(&this->left_);
+    optimizeChild(&this->right_);
+
+    auto folded = fold(*this->left_, *this->right_, &Value::add);
+    if (folded != nullptr) {
+        return replace(this, folded);
+    }
+
+    /* x + 0 and 0 + x.  Only for integers, because -0.0 + 0 is 0.0.  */
+    if (isIntegerConstant(*this->right_, 0) &&
+            this->left_->getKind() == Scope::kInteger) {
+        return replace(this, this->left_.release());
+    }
+    if (isIntegerConstant(*this->left_, 0) &&
+            this->right_->getKind() == Scope::kInteger) {
+        return replace(this, this->right_.release());
+    }
+    return this;
+}
+
+Scope::Kind AddExpression::getKind() const {
+    return getArithmeticKind(*this->left_, *this->right_);
+}
+
+bool AddExpression::getScalarType(const bool *floatParams,
+                                  bool *isFloat) const {
+    return getArithmeticType(*this->left_, *this->right_, floatParams,
+                             isFloat);
+}
+
+Accumulation AddExpression::getAccumulation(int slot) const {
+    auto &l = *this->left_, &r = *this->right_;
+    if (accumulates(l, r, slot, kSumAccumulation) ||
+            accumulates(r, l, slot, kSumAccumulation)) {
+        return kSumAccumulation;
+    }
+    return kNoAccumulation;
+}
+
+void AddExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Add" << std::endl;
+    this->left_->dump(out, indent + 1);
+    this->right_->dump(out, indent + 1);
+}
+
+int AddExpression::compile(Compiler *c) const {
+    auto l = this->left_->compile(c);
+    auto r = this->right_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kAdd, result, l, r);
+    return result;
+}
+
+bool AddExpression::getLinearForm(const bool *floatParams,
+                                  LinearForm *form) const {
+    LinearForm l, r;
+    return this->left_->getLinearForm(floatParams, &l) &&
+           this->right_->getLinearForm(floatParams, &r) &&
+           LinearForm::add(l, r, 1, form);
+}
+
+Expression *DivExpression::optimize() {
+    optimizeChild(&this->left_);
+    optimizeChild(&this->right_);
+
+    /* Integer division can trap instead of throwing an exception, so such
+     * expressions are left to fail at run time, if they are evaluated.  */
+    auto intMin = std::numeric_limits<int>::min();
+    auto traps = isIntegerConstant(*this->right_, 0) ||
+                 (isIntegerConstant(*this->right_, -1) &&
+                  isIntegerConstant(*this->left_, intMin));
+    auto folded = traps ? nullptr
+                        : fold(*this->left_, *this->right_, &Value::div);
+    if (folded != nullptr) {
+        return replace(this, folded);
+    }
+
+    /* x / 1.  */
+    if (isIntegerConstant(*this->right_, 1) && isScalar(*this->left_)) {
+        return replace(this, this->left_.release());
+    }
+    return this;
+}
+
+Scope::Kind DivExpression::getKind() const {
+    return getArithmeticKind(*this->left_, *this->right_);
+}
+
+bool DivExpression::getScalarType(const bool *floatParams,
+                                  bool *isFloat) const {
+    return getArithmeticType(*this->left_, *this->right_, floatParams,
+                             isFloat);
+}
+
+void DivExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Div" << std::endl;
+    this->left_->dump(out, indent + 1);
+    this->right_->dump(out, indent + 1);
+}
+
+int DivExpression::compile(Compiler *c) const {
+    auto l = this->left_->compile(c);
+    auto r = this->right_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kDiv, result, l, r);
+    return result;
+}
+
+int IdentifierExpression::compile(Compiler *c) const {
+    return c->loadVariable(this->slot_);
+}
+
+bool IdentifierExpression::getLinearForm(const bool *floatParams,
+                                         LinearForm *form) const {
+    if (this->slot_ >= LinearForm::kMaxParams) {
+        return false;
+    }
+    *form = LinearForm::makeParam(this->slot_, floatParams[this->slot_]);
+    return true;
+}
 
-    if (inputVal->isScalar()) {
+bool IdentifierExpression::getScalarType(const bool *floatParams,
+                                         bool *isFloat) const {
+    *isFloat = floatParams[this->slot_];
+    return true;
+}
+
+void IdentifierExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Identifier " << this->identifier_ << std::endl;
+}
+
+Value LoadExpression::evaluate(Context *ctx) const {
+    return VectorFile::load(this->path_);
+}
+
+int LoadExpression::compile(Compiler *c) const {
+    auto result = c->newRegister();
+    c->emit(Instruction::kLoadFile, result, c->addLoad(this));
+    return result;
+}
+
+void LoadExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Load " << this->path_ << std::endl;
+}
+
+void MapExpression::checkInput(const Value &input) {
+    if (input.isScalar()) {
         auto msg = "Can't perform map operation on scalar value.";
         throw std::invalid_argument(msg);
     }
+}
 
+Value MapExpression::apply(const Value &input, const MapStages &stages) {
+    checkInput(input);
+    /* Lambdas can create any number of sequences, so those are not kept in
+     * the arena until the end of statement.  */
+    Arena::Use heap(Arena::kTemporaries, nullptr);
+    if (canFuse(input, stages.begin(), stages.end() - 1)) {
+        return mapSequence(input, stages.begin(), stages.end());
+    }
 
-    auto inputSize = inputVal->getSize();
-    if (inputSize < multithreadingThreshold) {
-        auto r = new std::vector<ValuePtr>(getResult(inputVal,
-                                                     this->paramName_,
-                                                     this->func_));
-        return std::make_shared<const VectorValue>(r);
+    /* Apply stages one by one, storing intermediate results.  */
+    Value result = input;
+    for (auto stage = stages.begin(); stage != stages.end(); ++stage) {
+        result = mapSequence(result, stage, stage + 1);
     }
+    return result;
+}
 
-    auto slicesCount = std::min<int>(inputSize,
-                                     std::thread::hardware_concurrency());
-    auto begin = 0, end = 0;
-    auto sliceSize = inputSize / slicesCount;
-    std::vector< std::future< std::vector<ValuePtr> > > intermediate;
-
-    for (auto i = 0; i < slicesCount; i++) {
-        begin = end;
-        /* Make sure we don't last elements in last slice, in case inputSize
-         * doesn't divide evenly.  */
-        if (i == slicesCount - 1) {
-            end = inputSize;
-        } else {
-            end += sliceSize;
+Value MapExpression::evaluate(Context *ctx) const {
+    return this->apply(this->input_->evaluate(ctx));
+}
+
+Expression *MapExpression::optimize() {
+    optimizeChild(&this->input_);
+    for (auto &&stage : this->stages_) {
+        stage->optimize();
+    }
+
+    /* map(map(x, f), g) becomes map of x with stages f and g.  Input has been
+     * optimized already, so it has absorbed its own input maps.  */
+    auto inner = dynamic_cast<MapExpression*>(this->input_.get());
+    if (inner != nullptr) {
+        MapStages stages = std::move(inner->stages_);
+        for (auto &&stage : this->stages_) {
+            stages.push_back(std::move(stage));
         }
+        this->stages_ = std::move(stages);
+        this->input_ = std::move(inner->input_);
+    }
+    return this;
+}
 
-        auto future = std::async(std::launch::async, getResult,
-                                 inputVal->getSlice(begin, end),
-                                 this->paramName_, this->func_);
-        intermediate.push_back(std::move(future));
+void MapExpression::profileChildren(int depth, Profile::Clock clock) {
+    profileChild(&this->input_, depth, clock);
+    for (auto &&stage : this->stages_) {
+        stage->profile(depth);
     }
+}
+
+void MapExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Map" << std::endl;
+    this->input_->dump(out, indent + 1);
+    for (auto &&stage : this->stages_) {
+        stage->dump(out, indent + 1);
+    }
+}
 
-    auto vector = new std::vector<ValuePtr>();
-    vector->reserve(inputSize);
-    for (auto &&future : intermediate) {
-        auto slice = future.get();
-        vector->insert(vector->end(), slice.begin(), slice.end());
+int MapExpression::compile(Compiler *c) const {
+    auto input = this->input_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kMap, result, input, c->addMap(this));
+    return result;
+}
+
+Expression *MulExpression::optimize() {
+    optimizeChild(&this->left_);
+    optimizeChild(&this->right_);
+
+    auto folded = fold(*this->left_, *this->right_, &Value::mul);
+    if (folded != nullptr) {
+        return replace(this, folded);
+    }
+
+    /* x * 1 and 1 * x.  */
+    if (isIntegerConstant(*this->right_, 1) && isScalar(*this->left_)) {
+        return replace(this, this->left_.release());
+    }
+    if (isIntegerConstant(*this->left_, 1) && isScalar(*this->right_)) {
+        return replace(this, this->right_.release());
     }
-    return std::make_shared<const VectorValue>(vector);
+    return this;
 }
 
-ValuePtr ReduceExpression::getResult(ValuePtr input, ValuePtr dflt,
-                                     const std::string &param1,
-                                     const std::string &param2,
-                                     std::shared_ptr<const Expression> func) {
-    Context funcCtx;
-    auto result = dflt;
-    for (; !input->isNone(); input = input->next()) {
-        funcCtx.setVariable(param1, result);
-        funcCtx.setVariable(param2, input->asScalar());
-        result = func->evaluate(&funcCtx);
+Scope::Kind MulExpression::getKind() const {
+    return getArithmeticKind(*this->left_, *this->right_);
+}
+
+bool MulExpression::getScalarType(const bool *floatParams,
+                                  bool *isFloat) const {
+    return getArithmeticType(*this->left_, *this->right_, floatParams,
+                             isFloat);
+}
+
+Accumulation MulExpression::getAccumulation(int slot) const {
+    auto &l = *this->left_, &r = *this->right_;
+    if (accumulates(l, r, slot, kProductAccumulation) ||
+            accumulates(r, l, slot, kProductAccumulation)) {
+        return kProductAccumulation;
     }
+    return kNoAccumulation;
+}
 
-    if (!result->isScalar()) {
+void MulExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Mul" << std::endl;
+    this->left_->dump(out, indent + 1);
+    this->right_->dump(out, indent + 1);
+}
+
+int MulExpression::compile(Compiler *c) const {
+    auto l = this->left_->compile(c);
+    auto r = this->right_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kMul, result, l, r);
+    return result;
+}
+
+bool MulExpression::getLinearForm(const bool *floatParams,
+                                  LinearForm *form) const {
+    LinearForm l, r;
+    return this->left_->getLinearForm(floatParams, &l) &&
+           this->right_->getLinearForm(floatParams, &r) &&
+           LinearForm::mul(l, r, form);
+}
+
+Expression *PowExpression::optimize() {
+    optimizeChild(&this->left_);
+    optimizeChild(&this->right_);
+
+    auto folded = fold(*this->left_, *this->right_, &Value::pow);
+    if (folded != nullptr) {
+        return replace(this, folded);
+    }
+
+    /* x ^ 1.  */
+    if (isIntegerConstant(*this->right_, 1) && isScalar(*this->left_)) {
+        return replace(this, this->left_.release());
+    }
+
+    /* x ^ 2 becomes x * x, if x is a variable, that can be read twice.  */
+    auto identifier = dynamic_cast<IdentifierExpression*>(this->left_.get());
+    if (isIntegerConstant(*this->right_, 2) && identifier != nullptr &&
+            isScalar(*identifier)) {
+        auto square = new MulExpression(this->left_.release(),
+                                        new IdentifierExpression(*identifier));
+        return replace(this, square);
+    }
+    return this;
+}
+
+Scope::Kind PowExpression::getKind() const {
+    return getArithmeticKind(*this->left_, *this->right_);
+}
+
+bool PowExpression::getScalarType(const bool *floatParams,
+                                  bool *isFloat) const {
+    return getArithmeticType(*this->left_, *this->right_, floatParams,
+                             isFloat);
+}
+
+void PowExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Pow" << std::endl;
+    this->left_->dump(out, indent + 1);
+    this->right_->dump(out, indent + 1);
+}
+
+int PowExpression::compile(Compiler *c) const {
+    auto l = this->left_->compile(c);
+    auto r = this->right_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kPow, result, l, r);
+    return result;
+}
+
+int RangeExpression::compile(Compiler *c) const {
+    auto begin = this->begin_->compile(c);
+    auto end = this->end_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kRange, result, begin, end);
+    return result;
+}
+
+void RangeExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Range" << std::endl;
+    this->begin_->dump(out, indent + 1);
+    this->end_->dump(out, indent + 1);
+}
+
+/**
+ * @brief Reduce input element by element, passing elements through map
+ * stages first.
+ */
+static Value reduceSerial(const Value &input, const Value &dflt,
+                          MapStages::const_iterator first,
+                          MapStages::const_iterator last,
+                          const Lambda &func) {
+    StagesCall stages(first, last);
+    LambdaCall funcCall(func);
+    Value args[2] = { dflt, Value() };
+    input.forEachChunk(0, input.getSize(), [&](const Chunk &chunk) {
+        for (int i = 0; i < chunk.size; i++) {
+            args[1] = stages.call(chunk.getItem(i));
+            args[0] = funcCall.call(args);
+        }
+    });
+
+    if (!args[0].isScalar()) {
         auto msg = "Can't return vector value as result of lambda function.";
         throw std::invalid_argument(msg);
     }
 
-    return result;
+    return args[0];
 }
 
-ValuePtr ReduceExpression::evaluate(Context *ctx) const {
-    auto inputVal = this->input_->evaluate(ctx);
+/**
+ * @brief Sum floating point numbers by recursively splitting them in halves,
+ * which keeps rounding error growing only logarithmically.
+ */
+static double sumPairwise(const Column &terms, int begin, int end) {
+    if (end - begin <= 8) {
+        double sum = 0;
+        for (int i = begin; i < end; i++) {
+            sum += terms.getFloat(i);
+        }
+        return sum;
+    }
+    auto middle = begin + (end - begin) / 2;
+    return sumPairwise(terms, begin, middle) +
+           sumPairwise(terms, middle, end);
+}
+
+/**
+ * @brief Sum floating point numbers with Kahan compensated summation.
+ */
+static double sumKahan(const Column &terms) {
+    double sum = 0, compensation = 0;
+    for (int i = 0; i < terms.getSize(); i++) {
+        auto y = terms.getFloat(i) - compensation;
+        auto t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+    return sum;
+}
+
+/**
+ * @brief Combine terms of a block into a single value.  Integer arithmetic
+ * wraps around, so it is exact in any order.
+ *
+ * @param isFloat Accumulate integer terms as floats, as it happens when
+ * accumulator starts with a float.
+ */
+static Value accumulateTerms(const Column &terms, Accumulation accumulation,
+                             bool isFloat) {
+    isFloat = isFloat || terms.isFloat();
+    auto size = terms.getSize();
+    if (accumulation == kProductAccumulation) {
+        if (isFloat) {
+            double product = 1;
+            for (int i = 0; i < size; i++) {
+                product *= terms.getFloat(i);
+            }
+            return Value(product);
+        }
+        uint32_t product = 1;
+        for (int i = 0; i < size; i++) {
+            product *= static_cast<uint32_t>(terms.getInteger(i));
+        }
+        return Value(static_cast<int>(product));
+    }
+
+    if (isFloat) {
+        if (Options::get().summation == Options::kKahanSummation) {
+            return Value(sumKahan(terms));
+        }
+        return Value(sumPairwise(terms, 0, size));
+    }
+    uint32_t sum = 0;
+    for (int i = 0; i < size; i++) {
+        sum += static_cast<uint32_t>(terms.getInteger(i));
+    }
+    return Value(static_cast<int>(sum));
+}
+
+/**
+ * @brief Combine partial results in a balanced tree.
+ */
+static Value combinePartials(const std::vector<Value> &partials, int begin,
+                             int end, Accumulation accumulation) {
+    if (end - begin == 1) {
+        return partials[begin];
+    }
+    auto middle = begin + (end - begin) / 2;
+    auto l = combinePartials(partials, begin, middle, accumulation);
+    auto r = combinePartials(partials, middle, end, accumulation);
+    return accumulation == kProductAccumulation ? l.mul(r) : l.add(r);
+}
+
+/* Input of a parallel reduction is split into blocks of this size, no matter
+ * how many threads there are, so results don't depend on the number of
+ * threads.  */
+static const int reduceBlockSize = 4096;
+
+/**
+ * @brief Compute terms for elements of a block and combine them.  Term is
+ * the result of lambda with accumulator set to the identity element: 0 for
+ * sums and 1 for products.
+ *
+ * @param terms Buffer for terms, reused between blocks.
+ */
+static Value reduceBlock(const Value &input, int begin, int end,
+                         StagesCall *stages, LambdaCall *func,
+                         Accumulation accumulation, bool isFloat,
+                         Column *terms) {
+    Value args[2] = {
+        Value(accumulation == kProductAccumulation ? 1 : 0), Value()
+    };
+    *terms = Column();
+    terms->reserve(end - begin);
+    input.forEachChunk(begin, end, [&](const Chunk &chunk) {
+        for (int i = 0; i < chunk.size; i++) {
+            args[1] = stages->call(chunk.getItem(i));
+            auto term = func->call(args);
+            if (!term.isScalar()) {
+                auto msg = "Can't return vector value as result of lambda "
+                           "function.";
+                throw std::invalid_argument(msg);
+            }
+            if (term.isScalarFloat()) {
+                terms->pushFloat(term.asFloat());
+            } else {
+                terms->pushInteger(term.asInteger());
+            }
+        }
+    });
+    return accumulateTerms(*terms, accumulation, isFloat);
+}
+
+/**
+ * @brief Reduce input.  Reductions that accumulate a sum or a product are
+ * done in parallel, others element by element.  Default value is used
+ * exactly once in either case.  Elements are passed through map stages
+ * first, if there are any.
+ */
+static Value reduceSequence(const Value &input, const Value &dflt,
+                            MapStages::const_iterator first,
+                            MapStages::const_iterator last,
+                            const Lambda &func, Accumulation accumulation) {
+    auto inputSize = input.getSize();
+
+    /* Vector accumulator would change the meaning of operations.  */
+    if (accumulation == kNoAccumulation || !dflt.isScalar() ||
+            dflt.isNone() || inputSize <= 0) {
+        return reduceSerial(input, dflt, first, last, func);
+    }
 
-    if (inputVal->isScalar()) {
+    auto blocksCount = (inputSize + reduceBlockSize - 1) / reduceBlockSize;
+    auto slicesCount = getSlicesCount(blocksCount);
+    std::vector<Value> partials(blocksCount);
+    ThreadPool::get().parallelFor(slicesCount, [&](int slice) {
+        int firstBlock, lastBlock;
+        getSliceBounds(blocksCount, slicesCount, slice, &firstBlock,
+                       &lastBlock);
+        StagesCall stages(first, last);
+        LambdaCall funcCall(func);
+        Column terms;
+        for (int block = firstBlock; block < lastBlock; block++) {
+            auto begin = block * reduceBlockSize;
+            auto end = std::min(begin + reduceBlockSize, inputSize);
+            partials[block] = reduceBlock(input, begin, end, &stages,
+                                          &funcCall, accumulation,
+                                          dflt.isScalarFloat(), &terms);
+        }
+    });
+
+    auto total = combinePartials(partials, 0, blocksCount, accumulation);
+    return accumulation == kProductAccumulation ? dflt.mul(total)
+                                                : dflt.add(total);
+}
+
+void ReduceExpression::checkInput(const Value &input) const {
+    /* If map has been fused into this reduce, then its error should be
+     * reported.  */
+    if (!this->stages_.empty()) {
+        MapExpression::checkInput(input);
+    } else if (input.isScalar()) {
         auto msg = "Can't perform reduce operation on scalar value.";
         throw std::invalid_argument(msg);
     }
+}
+
+/**
+ * @brief Recognise reduction of a range that can be computed with a formula,
+ * if options allow that.
+ * @returns nullptr if reduction should be done element by element.
+ */
+static std::unique_ptr<ClosedForm> getClosedForm(const Value &input,
+                                                 const Value &dflt,
+                                                 const MapStages &stages,
+                                                 const Lambda &func) {
+    auto mode = Options::get().closedForm;
+    auto range = dynamic_cast<const IntegerRangeValue*>(input.getSequence());
+    if (mode == Options::kClosedFormOff || range == nullptr) {
+        return nullptr;
+    }
 
-    auto inputSize = inputVal->getSize();
-    auto dflt = default_->evaluate(ctx);
+    auto closedForm = ClosedForm::recognise(*range, dflt, stages, func);
+    if (closedForm != nullptr && mode == Options::kClosedFormTrace) {
+        /* Message is formatted first, so that lines written by different
+         * threads don't mix.  */
+        std::stringstream msg;
+        msg << "NOTE: reduce of {" << range->getFirst() << ", "
+            << range->getFirst() + (range->getSize() - 1)
+            << "} is computed in closed form (" << closedForm->getName()
+            << ")." << std::endl;
+        Output::get().writeError(msg.str());
+    }
+    return closedForm;
+}
 
-    /* No reason for concurrency if input is too small.  */
-    if (inputSize < multithreadingThreshold) {
-        return getResult(inputVal, dflt, this->param1Name_, this->param2Name_,
-                         this->func_);
+Value ReduceExpression::apply(const Value &input, const Value &dflt) const {
+    Arena::Use heap(Arena::kTemporaries, nullptr);
+    auto first = this->stages_.begin(), last = this->stages_.end();
+    auto closedForm = getClosedForm(input, dflt, this->stages_, *this->func_);
+    if (closedForm != nullptr) {
+        auto range = static_cast<const IntegerRangeValue*>(
+            input.getSequence());
+        return closedForm->reduce(*range, 0, range->getSize(), dflt);
     }
 
-    auto slicesCount = std::min<int>(inputSize,
-                                     std::thread::hardware_concurrency());
-    std::vector< std::future< ValuePtr > > intermediate;
-    auto begin = 0, end = 0;
-    auto sliceSize = inputSize / slicesCount;
+    if (canFuse(input, first, last)) {
+        return reduceSequence(input, dflt, first, last, *this->func_,
+                              this->accumulation_);
+    }
 
-    for (auto i = 0; i < slicesCount; i++) {
-        begin = end;
-        /* Make sure we don't last elements in last slice, in case inputSize
-         * doesn't divide evenly.  */
-        if (i == slicesCount - 1) {
-            end = inputSize;
-        } else {
-            end += sliceSize;
-        }
+    auto mapped = MapExpression::apply(input, this->stages_);
+    return reduceSequence(mapped, dflt, last, last, *this->func_,
+                          this->accumulation_);
+}
+
+Value ReduceExpression::evaluate(Context *ctx) const {
+    auto inputVal = this->input_->evaluate(ctx);
+    this->checkInput(inputVal);
+    Profile::countElements(inputVal.getSize());
+    return this->apply(inputVal, this->default_->evaluate(ctx));
+}
+
+Expression *ReduceExpression::optimize() {
+    optimizeChild(&this->input_);
+    optimizeChild(&this->default_);
+    this->func_->optimize();
+    this->accumulation_ = this->func_->getBody()->getAccumulation(0);
 
-        auto future = std::async(std::launch::async, getResult,
-                                 inputVal->getSlice(begin, end),
-                                 dflt, this->param1Name_, this->param2Name_,
-                                 this->func_);
-        intermediate.push_back(std::move(future));
+    /* Default value is evaluated after the input map, so fused map would
+     * report its errors only after errors of default value.  Hence map is
+     * fused only if default value can't fail.  */
+    auto inner = dynamic_cast<MapExpression*>(this->input_.get());
+    auto simpleDefault =
+        dynamic_cast<ValueExpression*>(this->default_.get()) != nullptr ||
+        dynamic_cast<IdentifierExpression*>(this->default_.get()) != nullptr;
+    if (inner != nullptr && simpleDefault) {
+        this->stages_ = std::move(inner->stages_);
+        this->input_ = std::move(inner->input_);
     }
+    return this;
+}
+
+int ReduceExpression::compile(Compiler *c) const {
+    /* Input is checked before default value is evaluated, so errors are
+     * reported in the same order as by the tree walker.  */
+    auto input = this->input_->compile(c);
+    auto reduce = c->addReduce(this);
+    c->emit(Instruction::kCheckReduceInput, 0, input, reduce);
+    auto dflt = this->default_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kReduce, result, input, dflt, reduce);
+    return result;
+}
+
+void ReduceExpression::profileChildren(int depth, Profile::Clock clock) {
+    profileChild(&this->input_, depth, clock);
+    profileChild(&this->default_, depth, clock);
+    for (auto &&stage : this->stages_) {
+        stage->profile(depth);
+    }
+    this->func_->profile(depth);
+}
+
+void ReduceExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Reduce" << std::endl;
+    this->input_->dump(out, indent + 1);
+    this->default_->dump(out, indent + 1);
+    for (auto &&stage : this->stages_) {
+        stage->dump(out, indent + 1);
+    }
+    this->func_->dump(out, indent + 1);
+}
+
+Expression *SubExpression::optimize() {
+    optimizeChild(&this->left_);
+    optimizeChild(&this->right_);
 
-    auto intermediateValues = new std::vector<ValuePtr>();
-    intermediateValues->reserve(slicesCount);
-    for (auto &&future : intermediate) {
-        intermediateValues->push_back(future.get());
+    auto folded = fold(*this->left_, *this->right_, &Value::sub);
+    if (folded != nullptr) {
+        return replace(this, folded);
     }
 
-    return getResult(std::make_shared<const VectorValue>(intermediateValues),
-                     dflt, this->param1Name_, this->param2Name_, this->func_);
+    /* x - 0.  */
+    if (isIntegerConstant(*this->right_, 0) && isScalar(*this->left_)) {
+        return replace(this, this->left_.release());
+    }
+    return this;
+}
+
+Scope::Kind SubExpression::getKind() const {
+    return getArithmeticKind(*this->left_, *this->right_);
+}
+
+bool SubExpression::getScalarType(const bool *floatParams,
+                                  bool *isFloat) const {
+    return getArithmeticType(*this->left_, *this->right_, floatParams,
+                             isFloat);
+}
+
+Accumulation SubExpression::getAccumulation(int slot) const {
+    /* Only the subtrahend can be a term, acc can't be subtracted.  */
+    if (accumulates(*this->left_, *this->right_, slot, kSumAccumulation)) {
+        return kSumAccumulation;
+    }
+    return kNoAccumulation;
+}
+
+void SubExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Sub" << std::endl;
+    this->left_->dump(out, indent + 1);
+    this->right_->dump(out, indent + 1);
+}
+
+int SubExpression::compile(Compiler *c) const {
+    auto l = this->left_->compile(c);
+    auto r = this->right_->compile(c);
+    auto result = c->newRegister();
+    c->emit(Instruction::kSub, result, l, r);
+    return result;
+}
+
+bool SubExpression::getLinearForm(const bool *floatParams,
+                                  LinearForm *form) const {
+    LinearForm l, r;
+    return this->left_->getLinearForm(floatParams, &l) &&
+           this->right_->getLinearForm(floatParams, &r) &&
+           LinearForm::add(l, r, -1, form);
+}
+
+int ValueExpression::compile(Compiler *c) const {
+    auto result = c->newRegister();
+    c->emit(Instruction::kConst, result, c->addConstant(this->value_));
+    return result;
+}
+
+bool ValueExpression::getLinearForm(const bool *floatParams,
+                                    LinearForm *form) const {
+    auto &value = this->value_;
+    if (value.isNone() || !value.isScalar()) {
+        return false;
+    }
+    if (!value.isScalarFloat()) {
+        *form = LinearForm::makeConstant(value.asInteger(), false);
+        return true;
+    }
+
+    /* Float constants are allowed only if they are integers, which keeps
+     * arithmetic on them exact.  */
+    auto v = value.asFloat();
+    if (v != std::trunc(v) || std::fabs(v) > LinearForm::kMaxCoefficient ||
+            (v == 0 && std::signbit(v))) {
+        return false;
+    }
+    *form = LinearForm::makeConstant(static_cast<int64_t>(v), true);
+    return true;
+}
+
+bool ValueExpression::getScalarType(const bool *floatParams,
+                                    bool *isFloat) const {
+    if (this->value_.isNone() || !this->value_.isScalar()) {
+        return false;
+    }
+    *isFloat = this->value_.isScalarFloat();
+    return true;
+}
+
+std::string ValueExpression::getName() const {
+    if (this->value_.isNone() || this->value_.isScalar()) {
+        return "Value " + this->value_.asString();
+    }
+    return "Value of " + std::to_string(this->value_.getSize()) +
+           " elements";
+}
+
+void ValueExpression::dump(std::ostream *out, int indent) const {
+    indented(out, indent) << "Value " << this->value_.asString() << std::endl;
 }
 
 // vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
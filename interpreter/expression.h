@@ -18,191 +18,885 @@
 #ifndef EXPRESSION_H_
 #define EXPRESSION_H_
 
+#include <memory>
+#include <mutex> // NOLINT
+#include <ostream>
+#include <string>
+#include <vector>
+
 #include "context.h"
+#include "linearform.h"
+#include "profile.h"
 #include "value.h"
 
+class Bytecode;
+class Compiler;
+class JitCode;
+
+/**
+ * @brief How reduction lambda updates accumulator.  If it only adds to it, or
+ * only multiplies it by, a term that doesn't depend on the accumulator, then
+ * terms can be computed in parallel and combined in any order.
+ */
+enum Accumulation {
+    kNoAccumulation,
+    kSumAccumulation,
+    kProductAccumulation,
+};
+
 /**
  * @brief Interpeter expression.
  */
 class Expression {
+ private:
+    /* Where expression starts in the source, 0 if unknown.  */
+    int line_;
+    int column_;
+
+ protected:
+    /**
+     * @brief Profile children of this expression.
+     */
+    virtual void profileChildren(int depth, Profile::Clock clock) { }
+
  public:
-    Expression() { }
+    Expression() : line_(0), column_(0) { }
 
     virtual ~Expression() { }
 
+    /**
+     * @brief Rewrite this expression and its children into a more efficient
+     * equivalent.  Should be called after resolve().
+     *
+     * @returns Expression that should be used instead of this one.  If it is
+     * not this, then this expression has been deleted.
+     */
+    virtual Expression *optimize() {
+        return this;
+    }
+
+    /**
+     * @brief Replace expression with its optimized version.
+     */
+    static void optimizeChild(std::unique_ptr<Expression> *expr) {
+        expr->reset(expr->release()->optimize());
+    }
+
+    void setLocation(int line, int column) {
+        this->line_ = line;
+        this->column_ = column;
+    }
+
+    int getLine() const {
+        return this->line_;
+    }
+
+    int getColumn() const {
+        return this->column_;
+    }
+
+    /**
+     * @brief Register this expression and its children in the profile and
+     * wrap each of them into a node that measures its evaluation.  Should be
+     * called after optimize().
+     *
+     * @param depth Depth of this expression in the statement tree.
+     * @param clock How CPU time of the nodes is measured.
+     * @returns Expression that should be used instead of this one.
+     */
+    Expression *profile(int depth, Profile::Clock clock);
+
+    /**
+     * @brief Replace expression with its profiled version.
+     */
+    static void profileChild(std::unique_ptr<Expression> *expr, int depth,
+                             Profile::Clock clock) {
+        expr->reset(expr->release()->profile(depth, clock));
+    }
+
+    /**
+     * @brief Name of the node, the same as in dump().
+     */
+    virtual std::string getName() const = 0;
+
     /**
      * @brief Evaluate value of this expression.
      */
-    virtual ValuePtr evaluate(Context *ctx) const = 0;
+    virtual Value evaluate(Context *ctx) const = 0;
+
+    /**
+     * @brief Resolve identifiers in this expression to slots.
+     */
+    virtual void resolve(const Scope &scope) = 0;
+
+    /**
+     * @brief Check whether value of this expression depends on variable in
+     * given slot.
+     */
+    virtual bool readsVariable(int slot) const = 0;
+
+    /**
+     * @brief Check whether this expression is `acc + term' or `acc * term',
+     * where acc is a variable in given slot and term doesn't read it.  Sums
+     * can be nested and terms can be subtracted, like in `acc - x + 1'.
+     */
+    virtual Accumulation getAccumulation(int slot) const {
+        return kNoAccumulation;
+    }
+
+    /**
+     * @brief What is known about value of this expression without evaluating
+     * it.  Operations that can only produce a scalar or fail are scalar.
+     */
+    virtual Scope::Kind getKind() const {
+        return Scope::kUnknown;
+    }
+
+    /**
+     * @brief Emit bytecode for this expression.
+     * @returns Register that will hold the value of expression.
+     */
+    virtual int compile(Compiler *c) const = 0;
+
+    /**
+     * @brief Write this expression as a linear function of lambda parameters.
+     *
+     * @param floatParams Which parameters are floats, others are integers.
+     * @returns false if expression is not a linear function.
+     */
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const {
+        return false;
+    }
+
+    /**
+     * @brief Get type of this expression if it is arithmetic on scalar
+     * constants and lambda parameters.  Such expression can't throw and its
+     * type depends only on types of parameters.
+     *
+     * @param floatParams Which parameters are floats, others are integers.
+     * @returns false if expression is anything else.
+     */
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const {
+        return false;
+    }
+
+    /**
+     * @brief Print expression tree, a node per line.
+     */
+    virtual void dump(std::ostream *out, int indent) const = 0;
+};
+
+/**
+ * @brief Anonymous function that map and reduce apply to sequence elements.
+ *
+ * Lambda body is compiled into bytecode on first use, and then the same code
+ * is shared by all threads.  Native code is compiled the same way, once for
+ * each combination of parameter types.
+ */
+class Lambda {
+ public:
+    static const int kMaxJitParams = 2;
+
+ private:
+    std::vector<std::string> params_;
+    std::unique_ptr<Expression> body_;
+    mutable std::once_flag compileFlag_;
+    mutable std::unique_ptr<const Bytecode> code_;
+    mutable std::once_flag jitFlags_[1 << kMaxJitParams];
+    mutable std::unique_ptr<const JitCode> jitCode_[1 << kMaxJitParams];
+    /* Set when program is profiled.  */
+    Profile::Site *site_;
+
+ public:
+    Lambda(const std::vector<std::string> &params, Expression *body);
+
+    ~Lambda();
+
+    const std::vector<std::string> &getParams() const {
+        return this->params_;
+    }
+
+    const Expression *getBody() const {
+        return this->body_.get();
+    }
+
+    void optimize() {
+        Expression::optimizeChild(&this->body_);
+    }
+
+    /**
+     * @brief Register lambda and nodes of its body in the profile.  Lambdas
+     * are called for each element, so their nodes measure only wall time.
+     */
+    void profile(int depth);
+
+    Profile::Site *getSite() const {
+        return this->site_;
+    }
+
+    /**
+     * @brief Resolve identifiers in lambda body.  Lambda sees only its
+     * parameters, each of them has a slot equal to its position.
+     *
+     * @param kinds What is known about values of parameters.
+     */
+    void resolve(const std::vector<Scope::Kind> &kinds);
+
+    const Bytecode *getBytecode() const;
+
+    /**
+     * @brief Get native code of lambda.
+     *
+     * @param floatParams Bit i is set if parameter i is a float, otherwise
+     * it is an int.
+     * @returns nullptr if lambda can't be compiled.
+     */
+    const JitCode *getJitCode(unsigned floatParams) const;
+
+    void dump(std::ostream *out, int indent) const;
+};
+
+/**
+ * @brief State needed to call a lambda.  Each thread should use its own
+ * instance.
+ *
+ * Lambda is evaluated by the engine selected in options.  If JIT is enabled,
+ * calls with scalar arguments run native code instead, when lambda can be
+ * compiled.
+ */
+class LambdaCall {
+ private:
+    const Lambda &lambda_;
+    const Bytecode *code_;
+    Context ctx_;
+    std::vector<Value> registers_;
+    bool useJit_;
+    /* Native code for each combination of parameter types, looked up on
+     * first call with such types.  */
+    const JitCode *jitCode_[1 << Lambda::kMaxJitParams];
+    bool jitFetched_[1 << Lambda::kMaxJitParams];
+    std::vector<uint64_t> slots_;
+
+    /**
+     * @brief Try to call native code.
+     * @returns false if lambda has to be interpreted.
+     */
+    bool callJit(const Value *args, Value *result);
+
+ public:
+    explicit LambdaCall(const Lambda &lambda);
+
+    /**
+     * @brief Call lambda.
+     * @param args Arguments, one for each of lambda parameters.
+     */
+    Value call(const Value *args);
 };
 
 class AddExpression : public Expression {
  private:
-    std::unique_ptr<const Expression> left_;
-    std::unique_ptr<const Expression> right_;
+    std::unique_ptr<Expression> left_;
+    std::unique_ptr<Expression> right_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock) {
+        profileChild(&this->left_, depth, clock);
+        profileChild(&this->right_, depth, clock);
+    }
 
  public:
-    AddExpression(const Expression* left, const Expression* right)
+    AddExpression(Expression* left, Expression* right)
         : left_(left), right_(right) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
+    virtual std::string getName() const {
+        return "Add";
+    }
+
+    virtual Value evaluate(Context *ctx) const {
         auto l = this->left_->evaluate(ctx);
-        return l->add(this->right_->evaluate(ctx));
+        return l.add(this->right_->evaluate(ctx));
     }
+
+    virtual Expression *optimize();
+
+    virtual Scope::Kind getKind() const;
+
+    virtual Accumulation getAccumulation(int slot) const;
+
+    virtual void resolve(const Scope &scope) {
+        this->left_->resolve(scope);
+        this->right_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->left_->readsVariable(slot) ||
+               this->right_->readsVariable(slot);
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class DivExpression : public Expression {
  private:
-    std::unique_ptr<const Expression> left_;
-    std::unique_ptr<const Expression> right_;
+    std::unique_ptr<Expression> left_;
+    std::unique_ptr<Expression> right_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock) {
+        profileChild(&this->left_, depth, clock);
+        profileChild(&this->right_, depth, clock);
+    }
 
  public:
-    DivExpression(const Expression* left, const Expression* right)
+    DivExpression(Expression* left, Expression* right)
         : left_(left), right_(right) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
+    virtual std::string getName() const {
+        return "Div";
+    }
+
+    virtual Value evaluate(Context *ctx) const {
         auto l = this->left_->evaluate(ctx);
-        return l->div(this->right_->evaluate(ctx));
+        return l.div(this->right_->evaluate(ctx));
     }
+
+    virtual Expression *optimize();
+
+    virtual Scope::Kind getKind() const;
+
+    virtual void resolve(const Scope &scope) {
+        this->left_->resolve(scope);
+        this->right_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->left_->readsVariable(slot) ||
+               this->right_->readsVariable(slot);
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class IdentifierExpression : public Expression {
  private:
     std::string identifier_;
+    int slot_;
+    Scope::Kind kind_;
 
  public:
     explicit IdentifierExpression(const std::string &identifier)
-        : identifier_(identifier) {
+        : identifier_(identifier), slot_(-1), kind_(Scope::kUnknown) {
+    }
+
+    virtual std::string getName() const {
+        return "Identifier " + this->identifier_;
+    }
+
+    virtual Value evaluate(Context *ctx) const {
+        return ctx->getVariable(this->slot_);
+    }
+
+    virtual void resolve(const Scope &scope) {
+        this->slot_ = scope.resolve(this->identifier_);
+        this->kind_ = scope.getKind(this->slot_);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->slot_ == slot;
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
-        return ctx->getVariable(this->identifier_);
+    virtual Scope::Kind getKind() const {
+        return this->kind_;
     }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
+/**
+ * @brief `load "file"', vector mapped from a file written by `save'.
+ */
+class LoadExpression : public Expression {
+ private:
+    std::string path_;
+
+ public:
+    explicit LoadExpression(const std::string &path) : path_(path) {
+    }
+
+    virtual std::string getName() const {
+        return "Load " + this->path_;
+    }
+
+    virtual Value evaluate(Context *ctx) const;
+
+    virtual void resolve(const Scope &scope) {
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return false;
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
+};
+
+/**
+ * @brief Lambdas applied one after another to each element of a sequence.
+ *
+ * Nested map operations are fused into a single list of stages, so elements
+ * are passed through all of them in one pass, without storing intermediate
+ * sequences.
+ */
+typedef std::vector< std::unique_ptr<Lambda> > MapStages;
+
 class MapExpression : public Expression {
+    friend class ReduceExpression;
+
  private:
-    std::string paramName_;
-    std::unique_ptr<const Expression> input_;
-    std::shared_ptr<const Expression> func_;
+    std::unique_ptr<Expression> input_;
+    MapStages stages_;
 
-    static std::vector<ValuePtr> getResult(ValuePtr input,
-                              const std::string &paramName,
-                              std::shared_ptr<const Expression> func);
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock);
 
  public:
-    MapExpression(const Expression *input, const std::string &paramName,
-                  const Expression *func)
-        : input_(input), paramName_(paramName), func_(func) {
+    MapExpression(Expression *input, const std::string &paramName,
+                  Expression *func)
+        : input_(input) {
+        this->stages_.emplace_back(
+            new Lambda(std::vector<std::string>{paramName}, func));
+    }
+
+    /**
+     * @brief Throw an error if value can't be an input of map.
+     */
+    static void checkInput(const Value &input);
+
+    /**
+     * @brief Apply stages to every element of the input sequence.
+     */
+    static Value apply(const Value &input, const MapStages &stages);
+
+    /**
+     * @brief Apply lambda to every element of the input sequence.
+     */
+    Value apply(const Value &input) const {
+        return apply(input, this->stages_);
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const;
+    virtual Value evaluate(Context *ctx) const;
+
+    virtual Expression *optimize();
+
+    virtual std::string getName() const {
+        return "Map";
+    }
+
+    virtual void resolve(const Scope &scope) {
+        this->input_->resolve(scope);
+        for (auto &&stage : this->stages_) {
+            stage->resolve({Scope::kScalar});
+        }
+    }
+
+    /* Lambdas see only their own parameters.  */
+    virtual bool readsVariable(int slot) const {
+        return this->input_->readsVariable(slot);
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class MulExpression : public Expression {
  private:
-    std::unique_ptr<const Expression> left_;
-    std::unique_ptr<const Expression> right_;
+    std::unique_ptr<Expression> left_;
+    std::unique_ptr<Expression> right_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock) {
+        profileChild(&this->left_, depth, clock);
+        profileChild(&this->right_, depth, clock);
+    }
 
  public:
-    MulExpression(const Expression* left, const Expression* right)
+    MulExpression(Expression* left, Expression* right)
         : left_(left), right_(right) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
+    virtual std::string getName() const {
+        return "Mul";
+    }
+
+    virtual Value evaluate(Context *ctx) const {
         auto l = this->left_->evaluate(ctx);
-        return l->mul(this->right_->evaluate(ctx));
+        return l.mul(this->right_->evaluate(ctx));
+    }
+
+    virtual Expression *optimize();
+
+    virtual Scope::Kind getKind() const;
+
+    virtual Accumulation getAccumulation(int slot) const;
+
+    virtual void resolve(const Scope &scope) {
+        this->left_->resolve(scope);
+        this->right_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->left_->readsVariable(slot) ||
+               this->right_->readsVariable(slot);
     }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class PowExpression : public Expression {
  private:
-    std::unique_ptr<const Expression> left_;
-    std::unique_ptr<const Expression> right_;
+    std::unique_ptr<Expression> left_;
+    std::unique_ptr<Expression> right_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock) {
+        profileChild(&this->left_, depth, clock);
+        profileChild(&this->right_, depth, clock);
+    }
 
  public:
-    PowExpression(const Expression* left, const Expression* right)
+    PowExpression(Expression* left, Expression* right)
         : left_(left), right_(right) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
+    virtual std::string getName() const {
+        return "Pow";
+    }
+
+    virtual Value evaluate(Context *ctx) const {
         auto l = this->left_->evaluate(ctx);
-        return l->pow(this->right_->evaluate(ctx));
+        return l.pow(this->right_->evaluate(ctx));
     }
+
+    virtual Expression *optimize();
+
+    virtual Scope::Kind getKind() const;
+
+    virtual void resolve(const Scope &scope) {
+        this->left_->resolve(scope);
+        this->right_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->left_->readsVariable(slot) ||
+               this->right_->readsVariable(slot);
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class RangeExpression : public Expression {
  private:
-    std::unique_ptr<const Expression> begin_;
-    std::unique_ptr<const Expression> end_;
+    std::unique_ptr<Expression> begin_;
+    std::unique_ptr<Expression> end_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock) {
+        profileChild(&this->begin_, depth, clock);
+        profileChild(&this->end_, depth, clock);
+    }
 
  public:
-    RangeExpression(const Expression* begin, const Expression* end)
+    RangeExpression(Expression* begin, Expression* end)
         : begin_(begin), end_(end) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
-        int begin  = this->begin_->evaluate(ctx)->asInteger();
-        int end = this->end_->evaluate(ctx)->asInteger();
-        return std::make_shared<const IntegerRangeValue>(begin, end);
+    virtual std::string getName() const {
+        return "Range";
+    }
+
+    virtual Value evaluate(Context *ctx) const {
+        int begin  = this->begin_->evaluate(ctx).asInteger();
+        int end = this->end_->evaluate(ctx).asInteger();
+        return Value(new IntegerRangeValue(begin, end));
+    }
+
+    virtual Expression *optimize() {
+        optimizeChild(&this->begin_);
+        optimizeChild(&this->end_);
+        return this;
+    }
+
+    virtual void resolve(const Scope &scope) {
+        this->begin_->resolve(scope);
+        this->end_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->begin_->readsVariable(slot) ||
+               this->end_->readsVariable(slot);
     }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class ReduceExpression : public Expression {
  private:
-    std::string param1Name_;
-    std::string param2Name_;
-    std::unique_ptr<const Expression> default_;
-    std::unique_ptr<const Expression> input_;
-    std::shared_ptr<const Expression> func_;
+    std::unique_ptr<Expression> default_;
+    std::unique_ptr<Expression> input_;
+    /* Stages of a map fused into this reduce, applied to input elements
+     * before they are passed to func.  */
+    MapStages stages_;
+    std::unique_ptr<Lambda> func_;
+    /* Found by optimize(), reduction is done element by element in order
+     * if it is unknown.  */
+    Accumulation accumulation_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock);
 
  public:
-    ReduceExpression(const Expression *input, const Expression *def,
+    ReduceExpression(Expression *input, Expression *def,
                     const std::string &param1Name,
                     const std::string &param2Name,
-                    const Expression *func)
-        : input_(input), default_(def), param1Name_(param1Name)
-        , param2Name_(param2Name), func_(func) {
+                    Expression *func)
+        : input_(input), default_(def),
+          func_(new Lambda(std::vector<std::string>{param1Name, param2Name},
+                           func)),
+          accumulation_(kNoAccumulation) {
     }
 
-    static ValuePtr getResult(ValuePtr input, ValuePtr dflt,
-                              const std::string &param1,
-                              const std::string &param2,
-                              std::shared_ptr<const Expression> func);
+    /**
+     * @brief Throw an error if value can't be an input of reduce.
+     */
+    void checkInput(const Value &input) const;
+
+    /**
+     * @brief Reduce input sequence into a single value.
+     *
+     * @param input Sequence, should be already checked with checkInput().
+     * @param dflt Initial value of accumulator.
+     */
+    Value apply(const Value &input, const Value &dflt) const;
+
+    virtual Value evaluate(Context *ctx) const;
 
-    virtual ValuePtr evaluate(Context *ctx) const;
+    virtual Expression *optimize();
+
+    virtual std::string getName() const {
+        return "Reduce";
+    }
+
+    virtual void resolve(const Scope &scope) {
+        this->input_->resolve(scope);
+        this->default_->resolve(scope);
+        for (auto &&stage : this->stages_) {
+            stage->resolve({Scope::kScalar});
+        }
+        /* Accumulator starts with the default value, which can be anything,
+         * but elements are always scalars.  */
+        this->func_->resolve({Scope::kUnknown, Scope::kScalar});
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->input_->readsVariable(slot) ||
+               this->default_->readsVariable(slot);
+    }
+
+    virtual Scope::Kind getKind() const {
+        return Scope::kScalar;
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class SubExpression : public Expression {
  private:
-    std::unique_ptr<const Expression> left_;
-    std::unique_ptr<const Expression> right_;
+    std::unique_ptr<Expression> left_;
+    std::unique_ptr<Expression> right_;
+
+ protected:
+    virtual void profileChildren(int depth, Profile::Clock clock) {
+        profileChild(&this->left_, depth, clock);
+        profileChild(&this->right_, depth, clock);
+    }
 
  public:
-    SubExpression(const Expression* left, const Expression* right)
+    SubExpression(Expression* left, Expression* right)
         : left_(left), right_(right) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
+    virtual std::string getName() const {
+        return "Sub";
+    }
+
+    virtual Value evaluate(Context *ctx) const {
         auto l = this->left_->evaluate(ctx);
-        return l->sub(this->right_->evaluate(ctx));
+        return l.sub(this->right_->evaluate(ctx));
+    }
+
+    virtual Expression *optimize();
+
+    virtual Scope::Kind getKind() const;
+
+    virtual Accumulation getAccumulation(int slot) const;
+
+    virtual void resolve(const Scope &scope) {
+        this->left_->resolve(scope);
+        this->right_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->left_->readsVariable(slot) ||
+               this->right_->readsVariable(slot);
     }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
 };
 
 class ValueExpression : public Expression {
  private:
-    ValuePtr value_;
+    Value value_;
 
  public:
-    explicit ValueExpression(const ScalarValue &v) {
-        this->value_ = std::make_shared<const ScalarValue>(v);
+    explicit ValueExpression(const Value &v) : value_(v) {
     }
 
-    virtual ValuePtr evaluate(Context *ctx) const {
+    const Value &getValue() const {
         return this->value_;
     }
+
+    virtual std::string getName() const;
+
+    virtual Value evaluate(Context *ctx) const {
+        return this->value_;
+    }
+
+    virtual void resolve(const Scope &scope) {
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return false;
+    }
+
+    virtual Scope::Kind getKind() const {
+        return Scope::kindOf(this->value_);
+    }
+
+    virtual int compile(Compiler *c) const;
+
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const;
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const;
+
+    virtual void dump(std::ostream *out, int indent) const;
+};
+
+/**
+ * @brief Node that measures evaluation of the wrapped expression with
+ * `--profile'.  Everything else is passed to the wrapped expression as is.
+ */
+class ProfiledExpression : public Expression {
+ private:
+    std::unique_ptr<Expression> expr_;
+    Profile::Site *site_;
+
+ public:
+    ProfiledExpression(Expression *expr, Profile::Site *site)
+        : expr_(expr), site_(site) {
+        this->setLocation(expr->getLine(), expr->getColumn());
+    }
+
+    virtual Value evaluate(Context *ctx) const {
+        Profile::Timer timer(this->site_);
+        auto value = this->expr_->evaluate(ctx);
+        if (!value.isScalar()) {
+            Profile::countElements(value.getSize());
+        }
+        return value;
+    }
+
+    virtual std::string getName() const {
+        return this->expr_->getName();
+    }
+
+    virtual void resolve(const Scope &scope) {
+        this->expr_->resolve(scope);
+    }
+
+    virtual bool readsVariable(int slot) const {
+        return this->expr_->readsVariable(slot);
+    }
+
+    virtual Accumulation getAccumulation(int slot) const {
+        return this->expr_->getAccumulation(slot);
+    }
+
+    virtual Scope::Kind getKind() const {
+        return this->expr_->getKind();
+    }
+
+    virtual int compile(Compiler *c) const {
+        return this->expr_->compile(c);
+    }
+
+    virtual bool getLinearForm(const bool *floatParams,
+                               LinearForm *form) const {
+        return this->expr_->getLinearForm(floatParams, form);
+    }
+
+    virtual bool getScalarType(const bool *floatParams, bool *isFloat) const {
+        return this->expr_->getScalarType(floatParams, isFloat);
+    }
+
+    virtual void dump(std::ostream *out, int indent) const {
+        this->expr_->dump(out, indent);
+    }
 };
 
 #endif  // EXPRESSION_H_
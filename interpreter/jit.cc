@@ -0,0 +1,359 @@
+/* Compiler of lambda bodies into native x86-64 code.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jit.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include <cmath>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__x86_64__)
+#define JIT_X86_64
+#endif
+
+/* Helpers called from the generated code for operations that are too complex
+ * to inline.  They reuse Value, so results are exactly the same as in the
+ * interpreter.  */
+
+static int powIntegers(int base, int exponent) {
+    return Value(base).pow(Value(exponent)).asInteger();
+}
+
+static double powFloats(double base, double exponent) {
+    return std::pow(base, exponent);
+}
+
+/**
+ * @brief Writer of x86-64 instructions that operate on slots.
+ *
+ * Address of the slots array is kept in rbx, which is preserved across calls
+ * of helpers, so each slot is addressed as [rbx + disp32].
+ */
+class Assembler {
+ private:
+    std::vector<uint8_t> bytes_;
+    /* Offsets of rel32 fields of jumps to the failure exit.  */
+    std::vector<size_t> failJumps_;
+
+ public:
+    enum Register {
+        kEax = 0,
+        kEcx = 1,
+        kEsi = 6,
+        kEdi = 7,
+    };
+
+    enum FloatOperation {
+        kAddsd = 0x58,
+        kMulsd = 0x59,
+        kSubsd = 0x5c,
+        kDivsd = 0x5e,
+    };
+
+    const std::vector<uint8_t> &getBytes() const {
+        return this->bytes_;
+    }
+
+    void emit(std::initializer_list<uint8_t> bytes) {
+        this->bytes_.insert(this->bytes_.end(), bytes);
+    }
+
+    void emit32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            this->bytes_.push_back(v >> (i * 8));
+        }
+    }
+
+    void emit64(uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+            this->bytes_.push_back(v >> (i * 8));
+        }
+    }
+
+    /**
+     * @brief ModRM byte and displacement of [rbx + slot * 8].
+     */
+    void emitSlot(int reg, int slot) {
+        this->emit({static_cast<uint8_t>(0x80 | (reg << 3) | 3)});
+        this->emit32(slot * 8);
+    }
+
+    void prologue() {
+        this->emit({0x53});                // push rbx
+        this->emit({0x48, 0x89, 0xfb});    // mov rbx, rdi
+    }
+
+    void loadInteger(Register reg, int slot) {
+        this->emit({0x8b});                // mov reg, [slot]
+        this->emitSlot(reg, slot);
+    }
+
+    void storeInteger(Register reg, int slot) {
+        this->emit({0x89});                // mov [slot], reg
+        this->emitSlot(reg, slot);
+    }
+
+    /**
+     * @brief Load slot into xmm register, converting an int to double.
+     */
+    void loadFloat(int xmm, int slot, bool isFloat) {
+        if (isFloat) {
+            this->emit({0xf2, 0x0f, 0x10});    // movsd xmm, [slot]
+        } else {
+            this->emit({0xf2, 0x0f, 0x2a});    // cvtsi2sd xmm, [slot]
+        }
+        this->emitSlot(xmm, slot);
+    }
+
+    void storeFloat(int slot) {
+        this->emit({0xf2, 0x0f, 0x11});    // movsd [slot], xmm0
+        this->emitSlot(0, slot);
+    }
+
+    void storeConstant(uint64_t bits, int slot) {
+        this->emit({0x48, 0xb8});          // mov rax, imm64
+        this->emit64(bits);
+        this->emit({0x48, 0x89});          // mov [slot], rax
+        this->emitSlot(kEax, slot);
+    }
+
+    /**
+     * @brief eax = eax op [slot] for add (0x03), sub (0x2b) and imul.
+     */
+    void integerOperation(uint8_t opcode, int slot) {
+        if (opcode == 0xaf) {
+            this->emit({0x0f, 0xaf});
+        } else {
+            this->emit({opcode});
+        }
+        this->emitSlot(kEax, slot);
+    }
+
+    void floatOperation(FloatOperation op) {
+        this->emit({0xf2, 0x0f, static_cast<uint8_t>(op), 0xc1});
+    }
+
+    /**
+     * @brief Divide int slots, jumping to the failure exit if the division
+     * would trap.
+     */
+    void divideIntegers(int dividend, int divisor, int dst) {
+        this->loadInteger(kEcx, divisor);
+        this->emit({0x85, 0xc9});              // test ecx, ecx
+        this->jumpToFailure(0x84);             // jz fail
+        this->emit({0x83, 0xf9, 0xff});        // cmp ecx, -1
+        this->emit({0x75, 16});                // jne over next 16 bytes
+        this->emit({0x81});                    // cmp dword [dividend], imm32
+        this->emitSlot(7, dividend);
+        this->emit32(0x80000000);
+        this->jumpToFailure(0x84);             // je fail
+        this->loadInteger(kEax, dividend);
+        this->emit({0x99});                    // cdq
+        this->emit({0xf7, 0xf9});              // idiv ecx
+        this->storeInteger(kEax, dst);
+    }
+
+    void call(const void *function) {
+        this->emit({0x48, 0xb8});              // mov rax, imm64
+        this->emit64(reinterpret_cast<uint64_t>(function));
+        this->emit({0xff, 0xd0});              // call rax
+    }
+
+    void jumpToFailure(uint8_t condition) {
+        this->emit({0x0f, condition});
+        this->failJumps_.push_back(this->bytes_.size());
+        this->emit32(0);
+    }
+
+    /**
+     * @brief Return 1, then emit the failure exit that returns 0.
+     */
+    void epilogue() {
+        this->emit({0xb8});                    // mov eax, 1
+        this->emit32(1);
+        this->emit({0x5b, 0xc3});              // pop rbx; ret
+        auto failure = this->bytes_.size();
+        for (auto &&offset : this->failJumps_) {
+            uint32_t rel = failure - (offset + 4);
+            memcpy(&this->bytes_[offset], &rel, sizeof(rel));
+        }
+        this->emit({0x31, 0xc0});              // xor eax, eax
+        this->emit({0x5b, 0xc3});              // pop rbx; ret
+    }
+};
+
+JitCode::~JitCode() {
+    if (this->memory_ != nullptr) {
+        munmap(this->memory_, this->size_);
+    }
+}
+
+std::unique_ptr<const JitCode> JitCode::compile(const Bytecode &code,
+                                                int paramsCount,
+                                                unsigned floatParams) {
+#ifdef JIT_X86_64
+    enum Type { kUnknown, kInteger, kFloat };
+    std::vector<Type> types(code.getRegistersCount(), kUnknown);
+    for (int i = 0; i < paramsCount; i++) {
+        types[i] = (floatParams & (1u << i)) ? kFloat : kInteger;
+    }
+
+    std::unique_ptr<JitCode> result(new JitCode());
+    result->slotsCount_ = code.getRegistersCount();
+    result->result_ = -1;
+
+    Assembler as;
+    as.prologue();
+    for (auto &&i : code.getInstructions()) {
+        if (i.op == Instruction::kConst) {
+            auto &value = code.getConstant(i.a);
+            if (value.isNone() || !value.isScalar()) {
+                return nullptr;
+            }
+            uint64_t bits = 0;
+            if (value.isScalarFloat()) {
+                auto v = value.asFloat();
+                memcpy(&bits, &v, sizeof(v));
+                types[i.dst] = kFloat;
+            } else {
+                bits = static_cast<uint32_t>(value.asInteger());
+                types[i.dst] = kInteger;
+            }
+            as.storeConstant(bits, i.dst);
+            continue;
+        }
+        if (i.op == Instruction::kReturn) {
+            if (types[i.a] == kUnknown) {
+                return nullptr;
+            }
+            result->result_ = i.a;
+            result->resultIsFloat_ = types[i.a] == kFloat;
+            break;
+        }
+
+        bool arithmetic = i.op == Instruction::kAdd ||
+                          i.op == Instruction::kSub ||
+                          i.op == Instruction::kMul ||
+                          i.op == Instruction::kDiv ||
+                          i.op == Instruction::kPow;
+        if (!arithmetic || types[i.a] == kUnknown ||
+                types[i.b] == kUnknown) {
+            return nullptr;
+        }
+
+        if (types[i.a] == kInteger && types[i.b] == kInteger) {
+            types[i.dst] = kInteger;
+            switch (i.op) {
+                case Instruction::kAdd:
+                case Instruction::kSub:
+                case Instruction::kMul:
+                    as.loadInteger(Assembler::kEax, i.a);
+                    as.integerOperation(i.op == Instruction::kAdd ? 0x03 :
+                                        i.op == Instruction::kSub ? 0x2b :
+                                                                    0xaf,
+                                        i.b);
+                    as.storeInteger(Assembler::kEax, i.dst);
+                    break;
+                case Instruction::kDiv:
+                    as.divideIntegers(i.a, i.b, i.dst);
+                    break;
+                default:
+                    as.loadInteger(Assembler::kEdi, i.a);
+                    as.loadInteger(Assembler::kEsi, i.b);
+                    as.call(reinterpret_cast<const void*>(&powIntegers));
+                    as.storeInteger(Assembler::kEax, i.dst);
+                    break;
+            }
+            continue;
+        }
+
+        types[i.dst] = kFloat;
+        as.loadFloat(0, i.a, types[i.a] == kFloat);
+        as.loadFloat(1, i.b, types[i.b] == kFloat);
+        switch (i.op) {
+            case Instruction::kAdd:
+                as.floatOperation(Assembler::kAddsd);
+                break;
+            case Instruction::kSub:
+                as.floatOperation(Assembler::kSubsd);
+                break;
+            case Instruction::kMul:
+                as.floatOperation(Assembler::kMulsd);
+                break;
+            case Instruction::kDiv:
+                as.floatOperation(Assembler::kDivsd);
+                break;
+            default:
+                as.call(reinterpret_cast<const void*>(&powFloats));
+                break;
+        }
+        as.storeFloat(i.dst);
+    }
+    if (result->result_ < 0) {
+        return nullptr;
+    }
+    as.epilogue();
+
+    /* Pages are never writable and executable at the same time.  */
+    auto &bytes = as.getBytes();
+    auto memory = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    result->memory_ = memory;
+    result->size_ = bytes.size();
+    memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+        return nullptr;
+    }
+    result->function_ = reinterpret_cast<Function>(memory);
+    return std::unique_ptr<const JitCode>(result.release());
+#else
+    return nullptr;
+#endif
+}
+
+void JitCode::setSlot(uint64_t *slots, int index, const Value &value) {
+    if (value.isScalarFloat()) {
+        auto v = value.asFloat();
+        memcpy(&slots[index], &v, sizeof(v));
+    } else {
+        slots[index] = static_cast<uint32_t>(value.asInteger());
+    }
+}
+
+bool JitCode::run(uint64_t *slots, Value *result) const {
+    if (!this->function_(slots)) {
+        return false;
+    }
+
+    auto &slot = slots[this->result_];
+    if (this->resultIsFloat_) {
+        double v;
+        memcpy(&v, &slot, sizeof(v));
+        *result = Value(v);
+    } else {
+        *result = Value(static_cast<int>(static_cast<uint32_t>(slot)));
+    }
+    return true;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
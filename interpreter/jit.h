@@ -0,0 +1,95 @@
+/* Compiler of lambda bodies into native x86-64 code.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "value.h"
+#include "vm.h"
+
+/**
+ * @brief Machine code of a lambda body, specialized for types of parameters.
+ *
+ * Code is translated from the bytecode, register by register: every
+ * bytecode register becomes an 8 byte slot in memory, that holds either an
+ * int or a double.  Type of each register is known at compile time, because
+ * types of parameters are fixed and arithmetic gives an int only on int
+ * operands.
+ *
+ * Only scalar arithmetic is supported.  Integer division, that would trap on
+ * a zero divisor, is checked at run time, and such calls are reported as
+ * failed, so that the caller can evaluate them with the interpreter.
+ */
+class JitCode {
+ private:
+    typedef int (*Function)(uint64_t *slots);
+
+    void *memory_;
+    size_t size_;
+    Function function_;
+    int slotsCount_;
+    int result_;
+    bool resultIsFloat_;
+
+    JitCode() : memory_(nullptr), size_(0) { }
+
+ public:
+    ~JitCode();
+
+    JitCode(const JitCode&) = delete;
+    JitCode &operator=(const JitCode&) = delete;
+
+    /**
+     * @brief Compile bytecode of a lambda.
+     *
+     * @param floatParams Bit i is set if parameter i is a float, otherwise
+     * it is an int.
+     * @returns nullptr if code can't be compiled.
+     */
+    static std::unique_ptr<const JitCode> compile(const Bytecode &code,
+                                                  int paramsCount,
+                                                  unsigned floatParams);
+
+    /**
+     * @brief Number of slots that should be passed to run().
+     */
+    int getSlotsCount() const {
+        return this->slotsCount_;
+    }
+
+    /**
+     * @brief Store an argument into a slot.
+     */
+    static void setSlot(uint64_t *slots, int index, const Value &value);
+
+    /**
+     * @brief Run the code.
+     *
+     * @param slots Arguments in the first slots, set with setSlot().
+     * @returns false if this call must be evaluated by the interpreter.
+     */
+    bool run(uint64_t *slots, Value *result) const;
+};
+
+#endif  // JIT_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
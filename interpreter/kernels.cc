@@ -0,0 +1,265 @@
+/* SIMD kernels for element-wise vector arithmetic.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernels.h"
+
+#include <stdint.h>
+
+#include "options.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Each operation is described by a structure with scalar implementations,
+ * used by generic kernels and for the tails of SIMD loops, and with vector
+ * implementations for each instruction set.  Integer operations are done on
+ * unsigned numbers, so that overflow wraps around without undefined
+ * behaviour.  */
+
+struct AddOperation {
+    static int integer(int a, int b) {
+        return static_cast<uint32_t>(a) + static_cast<uint32_t>(b);
+    }
+
+    static double real(double a, double b) {
+        return a + b;
+    }
+
+#ifdef KERNELS_X86
+    TARGET("sse2") static __m128i sse2(__m128i a, __m128i b) {
+        return _mm_add_epi32(a, b);
+    }
+
+    TARGET("sse2") static __m128d sse2(__m128d a, __m128d b) {
+        return _mm_add_pd(a, b);
+    }
+
+    TARGET("avx2") static __m256i avx2(__m256i a, __m256i b) {
+        return _mm256_add_epi32(a, b);
+    }
+
+    TARGET("avx2") static __m256d avx2(__m256d a, __m256d b) {
+        return _mm256_add_pd(a, b);
+    }
+#endif
+};
+
+struct SubOperation {
+    static int integer(int a, int b) {
+        return static_cast<uint32_t>(a) - static_cast<uint32_t>(b);
+    }
+
+    static double real(double a, double b) {
+        return a - b;
+    }
+
+#ifdef KERNELS_X86
+    TARGET("sse2") static __m128i sse2(__m128i a, __m128i b) {
+        return _mm_sub_epi32(a, b);
+    }
+
+    TARGET("sse2") static __m128d sse2(__m128d a, __m128d b) {
+        return _mm_sub_pd(a, b);
+    }
+
+    TARGET("avx2") static __m256i avx2(__m256i a, __m256i b) {
+        return _mm256_sub_epi32(a, b);
+    }
+
+    TARGET("avx2") static __m256d avx2(__m256d a, __m256d b) {
+        return _mm256_sub_pd(a, b);
+    }
+#endif
+};
+
+struct MulOperation {
+    static int integer(int a, int b) {
+        return static_cast<uint32_t>(a) * static_cast<uint32_t>(b);
+    }
+
+    static double real(double a, double b) {
+        return a * b;
+    }
+
+#ifdef KERNELS_X86
+    /* SSE2 has only 32x32->64 bit multiplication of even elements, so odd
+     * elements are shifted into even positions and low halves of both
+     * products are interleaved back.  */
+    TARGET("sse2") static __m128i sse2(__m128i a, __m128i b) {
+        auto even = _mm_mul_epu32(a, b);
+        auto odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+        auto low = _MM_SHUFFLE(0, 0, 2, 0);
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, low),
+                                  _mm_shuffle_epi32(odd, low));
+    }
+
+    TARGET("sse2") static __m128d sse2(__m128d a, __m128d b) {
+        return _mm_mul_pd(a, b);
+    }
+
+    TARGET("avx2") static __m256i avx2(__m256i a, __m256i b) {
+        return _mm256_mullo_epi32(a, b);
+    }
+
+    TARGET("avx2") static __m256d avx2(__m256d a, __m256d b) {
+        return _mm256_mul_pd(a, b);
+    }
+#endif
+};
+
+/* There are no SIMD instructions for integer division, so only floating
+ * point division has kernels.  */
+struct DivOperation {
+    static double real(double a, double b) {
+        return a / b;
+    }
+
+#ifdef KERNELS_X86
+    TARGET("sse2") static __m128d sse2(__m128d a, __m128d b) {
+        return _mm_div_pd(a, b);
+    }
+
+    TARGET("avx2") static __m256d avx2(__m256d a, __m256d b) {
+        return _mm256_div_pd(a, b);
+    }
+#endif
+};
+
+template <class Operation>
+static void integersGeneric(const int *a, const int *b, int *out, int size) {
+    for (int i = 0; i < size; i++) {
+        out[i] = Operation::integer(a[i], b[i]);
+    }
+}
+
+template <class Operation>
+static void floatsGeneric(const double *a, const double *b, double *out,
+                          int size) {
+    for (int i = 0; i < size; i++) {
+        out[i] = Operation::real(a[i], b[i]);
+    }
+}
+
+#ifdef KERNELS_X86
+template <class Operation>
+TARGET("sse2") static void integersSse2(const int *a, const int *b, int *out,
+                                        int size) {
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         Operation::sse2(x, y));
+    }
+    for (; i < size; i++) {
+        out[i] = Operation::integer(a[i], b[i]);
+    }
+}
+
+template <class Operation>
+TARGET("sse2") static void floatsSse2(const double *a, const double *b,
+                                      double *out, int size) {
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        auto x = _mm_loadu_pd(a + i);
+        auto y = _mm_loadu_pd(b + i);
+        _mm_storeu_pd(out + i, Operation::sse2(x, y));
+    }
+    for (; i < size; i++) {
+        out[i] = Operation::real(a[i], b[i]);
+    }
+}
+
+template <class Operation>
+TARGET("avx2") static void integersAvx2(const int *a, const int *b, int *out,
+                                        int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            Operation::avx2(x, y));
+    }
+    for (; i < size; i++) {
+        out[i] = Operation::integer(a[i], b[i]);
+    }
+}
+
+template <class Operation>
+TARGET("avx2") static void floatsAvx2(const double *a, const double *b,
+                                      double *out, int size) {
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        auto x = _mm256_loadu_pd(a + i);
+        auto y = _mm256_loadu_pd(b + i);
+        _mm256_storeu_pd(out + i, Operation::avx2(x, y));
+    }
+    for (; i < size; i++) {
+        out[i] = Operation::real(a[i], b[i]);
+    }
+}
+#endif
+
+static Kernels selectKernels(Kernels::InstructionSet allowed) {
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (allowed >= Kernels::kAvx2 && __builtin_cpu_supports("avx2")) {
+        return Kernels {
+            Kernels::kAvx2,
+            integersAvx2<AddOperation>,
+            integersAvx2<SubOperation>,
+            integersAvx2<MulOperation>,
+            floatsAvx2<AddOperation>,
+            floatsAvx2<SubOperation>,
+            floatsAvx2<MulOperation>,
+            floatsAvx2<DivOperation>,
+        };
+    }
+    if (allowed >= Kernels::kSse2 && __builtin_cpu_supports("sse2")) {
+        return Kernels {
+            Kernels::kSse2,
+            integersSse2<AddOperation>,
+            integersSse2<SubOperation>,
+            integersSse2<MulOperation>,
+            floatsSse2<AddOperation>,
+            floatsSse2<SubOperation>,
+            floatsSse2<MulOperation>,
+            floatsSse2<DivOperation>,
+        };
+    }
+#endif
+    return Kernels {
+        Kernels::kGeneric,
+        integersGeneric<AddOperation>,
+        integersGeneric<SubOperation>,
+        integersGeneric<MulOperation>,
+        floatsGeneric<AddOperation>,
+        floatsGeneric<SubOperation>,
+        floatsGeneric<MulOperation>,
+        floatsGeneric<DivOperation>,
+    };
+}
+
+const Kernels &Kernels::get() {
+    static const Kernels kernels = selectKernels(Options::get().simd);
+    return kernels;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
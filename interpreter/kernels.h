@@ -0,0 +1,65 @@
+/* SIMD kernels for element-wise vector arithmetic.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+/**
+ * @brief Element-wise arithmetic over contiguous arrays of numbers.
+ *
+ * Each kernel computes out[i] = a[i] op b[i] for i in [0, size).  Output
+ * array may be the same as one of the inputs.  Integer operations wrap
+ * around on overflow.
+ *
+ * Kernels are implemented with AVX2 and SSE2 instructions and in plain C++.
+ * The best variant supported by the CPU is selected on first use.
+ */
+class Kernels {
+ public:
+    typedef void (*IntegerKernel)(const int *a, const int *b, int *out,
+                                  int size);
+    typedef void (*FloatKernel)(const double *a, const double *b,
+                                double *out, int size);
+
+    /**
+     * @brief Instruction set used by the kernels.
+     */
+    enum InstructionSet {
+        kGeneric,
+        kSse2,
+        kAvx2,
+    };
+
+    InstructionSet instructionSet;
+    IntegerKernel addIntegers;
+    IntegerKernel subIntegers;
+    IntegerKernel mulIntegers;
+    FloatKernel addFloats;
+    FloatKernel subFloats;
+    FloatKernel mulFloats;
+    FloatKernel divFloats;
+
+    /**
+     * @brief Get kernels for the best instruction set that is supported by
+     * the CPU and is allowed by options.
+     */
+    static const Kernels &get();
+};
+
+#endif  // KERNELS_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,162 @@
+/* Linear functions of lambda parameters.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "linearform.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+LinearForm LinearForm::makeConstant(int64_t value, bool isFloat) {
+    LinearForm form = LinearForm();
+    form.constant = value;
+    form.isFloat = isFloat;
+    form.updateBounds();
+    return form;
+}
+
+LinearForm LinearForm::makeParam(int index, bool isFloat) {
+    LinearForm form = LinearForm();
+    form.coefficients[index] = 1;
+    form.isFloat = isFloat;
+    form.updateBounds();
+    return form;
+}
+
+bool LinearForm::add(const LinearForm &l, const LinearForm &r, int sign,
+                     LinearForm *result) {
+    if (l.isProduct || r.isProduct) {
+        return false;
+    }
+
+    LinearForm form = LinearForm();
+    for (int i = 0; i < kMaxParams; i++) {
+        form.coefficients[i] = l.coefficients[i] + sign * r.coefficients[i];
+    }
+    form.constant = l.constant + sign * r.constant;
+    form.isFloat = l.isFloat || r.isFloat;
+    for (int i = 0; i <= kMaxParams; i++) {
+        form.floatBounds[i] = std::max(l.floatBounds[i], r.floatBounds[i]);
+        form.integerBounds[i] = std::max(l.integerBounds[i],
+                                         r.integerBounds[i]);
+    }
+    if (!form.updateBounds()) {
+        return false;
+    }
+    *result = form;
+    return true;
+}
+
+bool LinearForm::mul(const LinearForm &l, const LinearForm &r,
+                     LinearForm *result) {
+    if (l.isProduct || r.isProduct) {
+        return false;
+    }
+
+    LinearForm form = LinearForm();
+    form.isFloat = l.isFloat || r.isFloat;
+    for (int i = 0; i <= kMaxParams; i++) {
+        form.floatBounds[i] = std::max(l.floatBounds[i], r.floatBounds[i]);
+        form.integerBounds[i] = std::max(l.integerBounds[i],
+                                         r.integerBounds[i]);
+    }
+
+    if (l.isConstant() || r.isConstant()) {
+        auto &scaled = l.isConstant() ? r : l;
+        auto factor = l.isConstant() ? l.constant : r.constant;
+        auto limit = factor == 0 ? kMaxCoefficient
+                                 : kMaxCoefficient / llabs(factor);
+        for (int i = 0; i < kMaxParams; i++) {
+            if (llabs(scaled.coefficients[i]) > limit) {
+                return false;
+            }
+            form.coefficients[i] = scaled.coefficients[i] * factor;
+        }
+        if (llabs(scaled.constant) > limit) {
+            return false;
+        }
+        form.constant = scaled.constant * factor;
+        if (!form.updateBounds()) {
+            return false;
+        }
+        *result = form;
+        return true;
+    }
+
+    /* Accumulator multiplied by something that doesn't depend on it.  */
+    auto isAccumulator = [](const LinearForm &f) {
+        return f.constant == 0 && f.coefficients[0] == 1 &&
+               f.coefficients[1] == 0;
+    };
+    const LinearForm *factor;
+    if (isAccumulator(l) && !r.dependsOn(0)) {
+        factor = &r;
+    } else if (isAccumulator(r) && !l.dependsOn(0)) {
+        factor = &l;
+    } else {
+        return false;
+    }
+    form.coefficients[1] = factor->coefficients[1];
+    form.constant = factor->constant;
+    form.isProduct = true;
+    *result = form;
+    return true;
+}
+
+bool LinearForm::isConstant() const {
+    for (int i = 0; i < kMaxParams; i++) {
+        if (this->coefficients[i] != 0) {
+            return false;
+        }
+    }
+    return !this->isProduct;
+}
+
+static double getBound(const int64_t *bounds, const double *params) {
+    double result = bounds[LinearForm::kMaxParams];
+    for (int i = 0; i < LinearForm::kMaxParams; i++) {
+        result += bounds[i] * params[i];
+    }
+    return result;
+}
+
+double LinearForm::getFloatBound(const double *params) const {
+    return getBound(this->floatBounds, params);
+}
+
+double LinearForm::getIntegerBound(const double *params) const {
+    return getBound(this->integerBounds, params);
+}
+
+bool LinearForm::updateBounds() {
+    auto bounds = this->isFloat ? this->floatBounds : this->integerBounds;
+    for (int i = 0; i < kMaxParams; i++) {
+        auto c = llabs(this->coefficients[i]);
+        if (c > kMaxCoefficient) {
+            return false;
+        }
+        bounds[i] = std::max<int64_t>(bounds[i], c);
+    }
+    auto c = llabs(this->constant);
+    if (c > kMaxCoefficient) {
+        return false;
+    }
+    bounds[kMaxParams] = std::max<int64_t>(bounds[kMaxParams], c);
+    return true;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,97 @@
+/* Linear functions of lambda parameters.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LINEARFORM_H_
+#define LINEARFORM_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Lambda body written as a function of its parameters p[i]:
+ *
+ *     c[0] * p[0] + c[1] * p[1] + constant
+ *
+ * or, for a product, as p[0] * (c[1] * p[1] + constant).
+ *
+ * Coefficients are exact integers.  Integer arithmetic of the interpreter
+ * wraps around, so for integer expressions the form is exact modulo 2^32.
+ * Floating point expressions are exact only if every intermediate value is an
+ * integer small enough to be represented exactly, so the largest
+ * coefficients of all sub-expressions are collected to check that.
+ */
+struct LinearForm {
+    static const int kMaxParams = 2;
+
+    /* Magnitude of coefficients is limited by 2^53, the largest range of
+     * integers exactly representable by double.  This also keeps their
+     * products within int64_t.  */
+    static const int64_t kMaxCoefficient = int64_t(1) << 53;
+
+    int64_t coefficients[kMaxParams];
+    int64_t constant;
+    bool isFloat;
+    bool isProduct;
+
+    /* Largest absolute values of coefficients, and of the constant in the
+     * last element, over all sub-expressions of float and of integer
+     * type.  */
+    int64_t floatBounds[kMaxParams + 1];
+    int64_t integerBounds[kMaxParams + 1];
+
+    static LinearForm makeConstant(int64_t value, bool isFloat);
+
+    static LinearForm makeParam(int index, bool isFloat);
+
+    /**
+     * @brief Form of `l + sign * r'.
+     * @returns false if the result is not a linear form.
+     */
+    static bool add(const LinearForm &l, const LinearForm &r, int sign,
+                    LinearForm *result);
+
+    /**
+     * @brief Form of `l * r'.
+     * @returns false if the result is not a linear form or a product.
+     */
+    static bool mul(const LinearForm &l, const LinearForm &r,
+                    LinearForm *result);
+
+    bool dependsOn(int param) const {
+        return this->coefficients[param] != 0;
+    }
+
+    bool isConstant() const;
+
+    /**
+     * @brief Largest absolute value of any sub-expression of float type, or
+     * of integer type, if absolute values of parameters are not larger than
+     * given ones.
+     */
+    double getFloatBound(const double *params) const;
+    double getIntegerBound(const double *params) const;
+
+ private:
+    /**
+     * @brief Include own coefficients into the bounds.
+     * @returns false if coefficients are too big to be computed exactly.
+     */
+    bool updateBounds();
+};
+
+#endif  // LINEARFORM_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
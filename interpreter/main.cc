@@ -15,103 +15,509 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "arena.h"
 #include "context.h"
 #include "error.h"
 #include "expression.h"
+#include "memstats.h"
+#include "options.h"
+#include "output.h"
+#include "profile.h"
+#include "resultcache.h"
+#include "server.h"
 #include "statement.h"
+#include "threadpool.h"
 #include "parser.h"
 #include "lexer.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 int yyparse(Statement **statement, yyscan_t scanner);
 
 /**
+ * @brief Parse a line of the program.
+ *
+ * Line is scanned in place, without copying, so it must be followed by two
+ * NUL characters, that are not counted in `size'.
+ *
  * @param out_statement isn't modified if there was a syntax error parsing the
  * string, or this was a comment line.
  */
-bool getAST(const char *stmt, int lineno, Statement **out_statement ) {
-    yyscan_t scanner;
-    YY_BUFFER_STATE state;
-
-    if (yylex_init(&scanner)) {
-        // couldn't initialize
-        return false;
-    }
-
-    state = yy_scan_string(stmt, scanner);
+bool getAST(yyscan_t scanner, char *line, size_t size, int lineno,
+            Statement **out_statement) {
+    YY_BUFFER_STATE state = yy_scan_buffer(line, size + 2, scanner);
     state->yy_bs_column = 0;
     yyset_lineno(lineno, scanner);
 
     /* Notice how yyparse doesn't follow Google Code style (and otherwise
      * pretty common) rule that output paramater should after the input
      * parameter.  */
-    if (yyparse(out_statement, scanner)) {
-        // error parsing
-        return false;
-    }
+    bool parsed = yyparse(out_statement, scanner) == 0;
 
     yy_delete_buffer(state, scanner);
 
-    yylex_destroy(scanner);
-
-    return true;
+    return parsed;
 }
 
-int main(int argc, char *argv[]) {
+/**
+ * @brief State of the program being executed.
+ *
+ * Sequences created by a statement are allocated in an arena, that is reset
+ * when the statement is done.
+ */
+struct Program {
+    yyscan_t scanner;
+    Context ctx;
     /* Columns are counted starting with 0 and I cannot find the way to make
      * them start counting from 1, so for consistency lines should be counted
      * starting with 0 as well.  */
-    int lineno = 0;
+    int lineno;
+    bool had_error;
+    Arena temporaries;
+    /* Set with `--cache'.  */
+    std::unique_ptr<ResultCache> cache;
 
-    Context ctx;
-    bool had_error = false;
+    Program()
+        : scanner(nullptr), ctx(), lineno(0), had_error(false), temporaries(),
+          cache() {
+        if (yylex_init(&this->scanner)) {
+            throw std::bad_alloc();
+        }
+        auto &cacheDir = Options::get().cacheDir;
+        if (!cacheDir.empty()) {
+            this->cache.reset(new ResultCache(cacheDir));
+        }
+    }
 
-    while (!std::cin.eof()) {
-        std::string input_string;
-        std::getline(std::cin, input_string);
+    ~Program() {
+        yylex_destroy(this->scanner);
+    }
+
+    Program(const Program&) = delete;
+    Program &operator=(const Program&) = delete;
+};
 
-        // Update line number,
-        lineno += 1;
+/**
+ * @brief Optimize and execute a resolved statement.
+ */
+static void executeStatement(Program *program, int lineno, Statement *stmt) {
+    stmt->optimize();
+    if (Options::get().dumpAst) {
+        std::stringstream dump;
+        stmt->dump(&dump);
+        Output::get().writeError(dump.str());
+    }
+    Profile::Site *site = nullptr;
+    if (Options::get().profile) {
+        site = stmt->profile(lineno);
+    }
+    Profile::Timer timer(site);
+    stmt->execute(&program->ctx);
+}
 
-        if (input_string.size() == 0) {
-            continue;
+/**
+ * @brief Execute a statement, unless there was an error in this or any
+ * preceding line.
+ *
+ * @param parsed false if there was a syntax error in the line.
+ * @param text Text of the line, used to find results in the cache.
+ */
+static void runStatement(Program *program, int lineno, bool parsed,
+                         Statement *stmt, const char *text, size_t size) {
+    if (!parsed) {
+        /* There was a syntax error, so interpreter shouldn't execute this
+         * or any following statements, but should try to move on with
+         * parsing, so it will find as many syntax errors, as possible.  */
+        program->had_error = true;
+    }
+
+    if (program->had_error || stmt == nullptr) {
+        delete stmt;
+        return;
+    }
+
+    auto &memoryStats = MemoryStats::get();
+    if (MemoryStats::isEnabled()) {
+        memoryStats.beginStatement();
+    }
+
+    try {
+        auto cache = program->cache.get();
+        uint64_t key = 0;
+        if (cache != nullptr) {
+            key = cache->getKey(text, size, program->ctx);
+        }
+        stmt->resolve(&program->ctx);
+        auto slot = stmt->getVariableSlot();
+        if (cache == nullptr || slot < 0) {
+            executeStatement(program, lineno, stmt);
+        } else {
+            Value result;
+            if (cache->find(key, &result)) {
+                program->ctx.setVariable(slot, result.promote());
+            } else {
+                executeStatement(program, lineno, stmt);
+                cache->store(key, program->ctx.getVariable(slot));
+            }
+            cache->setSlotKey(slot, key);
         }
+    } catch (std::exception &e) {
+        user_error(lineno, e.what());
+        program->had_error = true;
+    }
+
+    delete stmt;
+    program->temporaries.reset();
+
+    /* Clients of the server and programs that read output from a pipe, like
+     * the GUI, get output of each statement when it is done.  */
+    if (Options::get().server || Output::get().isPipe()) {
+        Output::get().flush();
+    }
+
+    if (MemoryStats::isEnabled()) {
+        std::string name;
+        size_t bytes;
+        program->ctx.findLargestVariable(&name, &bytes);
+        memoryStats.endStatement(lineno, name, bytes);
+    }
+}
+
+/**
+ * @brief Parse and execute the next line of the program.
+ *
+ * @param line Line without the newline, followed by two NUL characters.
+ */
+static void runLine(Program *program, char *line, size_t size) {
+    // Update line number,
+    program->lineno += 1;
+    auto lineno = program->lineno;
+
+    if (size == 0) {
+        return;
+    }
 
 #ifdef DEBUG
-        std::cout << "DEBUG:Parsing input line:" << input_string << std::endl;
+    std::cout << "DEBUG:Parsing input line:" << std::string(line, size)
+              << std::endl;
 #endif
 
-        Statement *stmt = nullptr;
-        if (!getAST(input_string.c_str(), lineno, &stmt)) {
-            /* There was a syntax error, so interpreter shouldn't execute this
-             * or any following statements, but should try to move on with
-             * parsing, so it will find as many syntax errors, as possible.  */
-            had_error = true;
+    Statement *stmt = nullptr;
+    bool parsed = getAST(program->scanner, line, size, lineno, &stmt);
+    runStatement(program, lineno, parsed, stmt, line, size);
+}
+
+/**
+ * @brief Map a regular file into memory, followed by two NUL characters.
+ *
+ * Mapping is private and writable, so that lines can be terminated in place
+ * without modifying the file.
+ *
+ * @returns nullptr if the file can't be mapped, for example if it is a pipe.
+ */
+static char *mapFile(int fd, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+            lseek(fd, 0, SEEK_CUR) != 0) {
+        return nullptr;
+    }
+    *size = st.st_size;
+
+    /* Anonymous mapping reserves space for the NULs, then the file is mapped
+     * over its start.  Rest of the last page of the file is filled with
+     * zeroes as well.  */
+    auto memory = mmap(nullptr, *size + 2, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    if (mmap(memory, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, 0) == MAP_FAILED) {
+        munmap(memory, *size + 2);
+        return nullptr;
+    }
+    return static_cast<char*>(memory);
+}
+
+static void runBuffer(Program *program, char *data, size_t size) {
+    char *end = data + size;
+    for (char *line = data; line < end; ) {
+        auto eol = static_cast<char*>(memchr(line, '\n', end - line));
+        if (eol == nullptr) {
+            eol = end;
         }
+        /* Newline and the first character of the next line are replaced
+         * with NULs while the line is parsed.  */
+        char next = eol[1];
+        eol[0] = eol[1] = '\0';
+        runLine(program, line, eol - line);
+        eol[1] = next;
+        line = eol + 1;
+    }
+}
+
+/* Lines are parsed in parallel in groups of this many lines.  */
+static const int parseChunkLines = 256;
+
+/**
+ * @brief Line parsed ahead of execution.
+ */
+struct ParsedLine {
+    int lineno;
+    bool parsed;
+    Statement *stmt;
+    /* Errors reported while parsing the line.  */
+    std::string errors;
+    const char *text;
+    size_t size;
+};
+
+/**
+ * @brief Parse groups of lines on all threads of the pool, then execute
+ * statements in the original order.
+ *
+ * Lines are independent of each other until they are executed, so only the
+ * order of execution and of error messages has to be kept.  Parse errors are
+ * collected and printed when execution reaches the line, so output is the
+ * same as of runBuffer().
+ */
+static void runBufferParallel(Program *program, char *data, size_t size) {
+    /* Start of each line, followed by the position after the newline of the
+     * last line.  */
+    std::vector<char*> lines;
+    char *end = data + size;
+    char *line = data;
+    while (line < end) {
+        lines.push_back(line);
+        auto eol = static_cast<char*>(memchr(line, '\n', end - line));
+        line = (eol == nullptr ? end : eol) + 1;
+    }
+    lines.push_back(line);
 
-        if (had_error || stmt == nullptr) {
-            continue;
+    int linesCount = lines.size() - 1;
+    int chunksCount = (linesCount + parseChunkLines - 1) / parseChunkLines;
+    if (chunksCount <= 1) {
+        runBuffer(program, data, size);
+        return;
+    }
+
+    std::vector< std::vector<ParsedLine> > chunks(chunksCount);
+    ThreadPool::get().parallelFor(chunksCount, [&](int chunk) {
+        yyscan_t scanner;
+        if (yylex_init(&scanner)) {
+            throw std::bad_alloc();
         }
+        ErrorCapture errors;
+        int first = chunk * parseChunkLines;
+        int last = std::min(first + parseChunkLines, linesCount);
+        for (int i = first; i < last; i++) {
+            char *line = lines[i];
+            char *eol = lines[i + 1] - 1;
+            size_t lineSize = eol - line;
+            if (lineSize == 0) {
+                continue;
+            }
 
-        try {
-            stmt->execute(&ctx);
-        } catch (std::exception &e) {
-            user_error(lineno, e.what());
-            had_error = true;
+            ParsedLine parsed = {
+                i + 1, false, nullptr, std::string(), line, lineSize,
+            };
+            if (i + 1 < last) {
+                char next = eol[1];
+                eol[0] = eol[1] = '\0';
+                parsed.parsed = getAST(scanner, line, lineSize, i + 1,
+                                       &parsed.stmt);
+                eol[1] = next;
+            } else {
+                /* Next line belongs to another group, that may be parsed
+                 * at the same time, so it can't be modified.  */
+                std::string copy(line, lineSize);
+                copy.append(2, '\0');
+                parsed.parsed = getAST(scanner, &copy[0], lineSize, i + 1,
+                                       &parsed.stmt);
+            }
+            parsed.errors = errors.take();
+            chunks[chunk].push_back(std::move(parsed));
         }
+        yylex_destroy(scanner);
+    });
 
-        delete stmt;
+    for (auto &&chunk : chunks) {
+        for (auto &&parsed : chunk) {
+            if (!parsed.errors.empty()) {
+                ErrorCapture::replay(parsed.errors);
+            }
+            runStatement(program, parsed.lineno, parsed.parsed, parsed.stmt,
+                         parsed.text, parsed.size);
+        }
+    }
+    program->lineno = linesCount;
+}
+
+/**
+ * @brief Write a report requested by an option to the file, or to standard
+ * error if file name is empty.
+ * @returns false if the file can't be written.
+ */
+static bool writeReport(const std::string &file,
+                        const std::function<void(std::ostream*)> &report) {
+    if (file.empty()) {
+        report(&std::cerr);
+        return true;
+    }
+    std::ofstream out(file);
+    report(&out);
+    out.close();
+    if (!out) {
+        std::cerr << "ERROR:" << file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void runStream(Program *program, std::istream *in) {
+    while (!in->eof()) {
+        std::string input_string;
+        std::getline(*in, input_string);
+        auto size = input_string.size();
+        input_string.append(2, '\0');
+        runLine(program, &input_string[0], size);
+    }
+}
+
+/**
+ * @brief Run a program in a new context.
+ *
+ * @param data Program in memory, followed by two NUL characters, or nullptr
+ * to read the program from the stream.
+ * @returns false if there were errors.
+ */
+static bool runProgram(char *data, size_t size, std::istream *in) {
+    Program program;
+    Arena::Use temporaries(Arena::kTemporaries, &program.temporaries);
+
+    if (data == nullptr) {
+        runStream(&program, in);
+    } else if (Options::get().parallelParse &&
+               ThreadPool::get().getThreadsCount() > 1) {
+        runBufferParallel(&program, data, size);
+    } else {
+        runBuffer(&program, data, size);
+    }
+    Output::get().flush();
+
+    /* Statements after an error weren't run, their results are kept for
+     * the next run.  Programs run by the server share the cache, so results
+     * one program didn't use can still be needed by another one.  */
+    if (program.cache != nullptr && !program.had_error &&
+            !Options::get().server) {
+        program.cache->removeUnused();
+    }
+    return !program.had_error;
+}
+
+/**
+ * @brief Write reports requested by options.
+ * @returns false if a report can't be written.
+ */
+static bool writeReports() {
+    auto &options = Options::get();
+    if (options.profile &&
+            !writeReport(options.profileFile, [](std::ostream *out) {
+                Profile::get().report(out);
+            })) {
+        return false;
+    }
+    if (options.memStats &&
+            !writeReport(options.memStatsFile, [](std::ostream *out) {
+                MemoryStats::get().report(out);
+            })) {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (!Options::get().parse(argc, argv)) {
+        Options::printUsage(&std::cerr, argv[0]);
+        return 2;
+    }
+
+    if (Options::get().memStats) {
+        MemoryStats::enable();
+    }
+
+    auto &options = Options::get();
+    auto &cacheDir = options.cacheDir;
+    if (!cacheDir.empty() && mkdir(cacheDir.c_str(), 0755) != 0 &&
+            errno != EEXIST) {
+        std::cerr << "ERROR:" << cacheDir << ": " << strerror(errno)
+                  << std::endl;
+        return 2;
+    }
+
+    if (options.server) {
+        Server server([](char *program, size_t size) {
+            return runProgram(program, size, nullptr);
+        });
+        if (options.serverSocket.empty()) {
+            server.serveStdin();
+        } else if (!server.serveSocket(options.serverSocket)) {
+            return 2;
+        }
+        return writeReports() ? 0 : 2;
+    }
+
+    /* Program is read from a file with mmap() when possible, so it is never
+     * copied line by line.  */
+    auto &script = options.script;
+    int fd = STDIN_FILENO;
+    if (!script.empty()) {
+        fd = open(script.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "ERROR:" << script << ": " << strerror(errno)
+                      << std::endl;
+            return 2;
+        }
     }
 
-    if (had_error) {
-        return 1;
+    size_t size;
+    char *data = mapFile(fd, &size);
+    bool ok;
+    if (data != nullptr) {
+        ok = runProgram(data, size, nullptr);
+        munmap(data, size + 2);
+    } else if (!script.empty()) {
+        std::ifstream in(script);
+        ok = runProgram(nullptr, 0, &in);
     } else {
-        return 0;
+        ok = runProgram(nullptr, 0, &std::cin);
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    if (!writeReports()) {
+        return 2;
     }
+    return ok ? 0 : 1;
 }
 
 // vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,137 @@
+/* Statistics of memory used by values.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memstats.h"
+
+#include <stdio.h>
+
+#include <string>
+
+bool MemoryStats::enabled_ = false;
+
+/**
+ * @brief Raise a peak to the value, if it is lower.
+ */
+static void raise(std::atomic<int64_t> *peak, int64_t value) {
+    auto current = peak->load(std::memory_order_relaxed);
+    while (current < value &&
+           !peak->compare_exchange_weak(current, value,
+                                        std::memory_order_relaxed)) {
+    }
+}
+
+void MemoryStats::Counter::add(int64_t amount) {
+    auto live = this->live.fetch_add(amount, std::memory_order_relaxed) +
+                amount;
+    this->total.fetch_add(amount, std::memory_order_relaxed);
+    raise(&this->peak, live);
+}
+
+void MemoryStats::addBytes(int64_t bytes) {
+    this->bytes_.add(bytes);
+    raise(&this->statementPeak_, this->bytes_.live.load());
+}
+
+int64_t MemoryStats::getTotalObjects() const {
+    int64_t total = 0;
+    for (auto &&counter : this->objects_) {
+        total += counter.total.load();
+    }
+    return total;
+}
+
+std::shared_ptr<const Column> MemoryStats::track(Column *column) {
+    if (!enabled_) {
+        return std::shared_ptr<const Column>(column);
+    }
+    int64_t bytes = column->getMemoryUsage();
+    get().addBytes(bytes);
+    return std::shared_ptr<const Column>(column, [bytes](const Column *c) {
+        get().removeBytes(bytes);
+        delete c;
+    });
+}
+
+void MemoryStats::beginStatement() {
+    this->startObjects_ = this->getTotalObjects();
+    this->startBytes_ = this->bytes_.total.load();
+    this->statementPeak_.store(this->bytes_.live.load());
+}
+
+void MemoryStats::endStatement(int line, const std::string &largestVariable,
+                               int64_t largestBytes) {
+    Line summary = {
+        line,
+        this->getTotalObjects() - this->startObjects_,
+        this->bytes_.total.load() - this->startBytes_,
+        this->bytes_.live.load(),
+        this->statementPeak_.load(),
+        largestVariable,
+        largestBytes,
+    };
+    this->lines_.push_back(summary);
+}
+
+void MemoryStats::report(std::ostream *out) const {
+    static const char *kindNames[kKindsCount] = {
+        "VectorValue", "IntegerRangeValue",
+    };
+
+    char line[160];
+    *out << "Memory:" << std::endl;
+    snprintf(line, sizeof(line), "%-6s %10s %14s %14s %14s  %s\n", "Line",
+             "Sequences", "Allocated", "Live", "Peak", "Largest variable");
+    *out << line;
+    for (auto &&l : this->lines_) {
+        snprintf(line, sizeof(line), "%-6d %10lld %14lld %14lld %14lld  ",
+                 l.line, static_cast<long long>(l.objects),  // NOLINT
+                 static_cast<long long>(l.bytes),  // NOLINT
+                 static_cast<long long>(l.live),  // NOLINT
+                 static_cast<long long>(l.peak));  // NOLINT
+        *out << line;
+        if (!l.largestVariable.empty()) {
+            *out << l.largestVariable << " (" << l.largestBytes << " bytes)";
+        }
+        *out << std::endl;
+    }
+
+    snprintf(line, sizeof(line), "%-18s %14s %14s %14s\n", "Totals", "Live",
+             "Peak", "Allocated");
+    *out << line;
+    for (int kind = 0; kind < kKindsCount; kind++) {
+        auto &counter = this->objects_[kind];
+        snprintf(line, sizeof(line), "%-18s %14lld %14lld %14lld\n",
+                 kindNames[kind],
+                 static_cast<long long>(counter.live.load()),  // NOLINT
+                 static_cast<long long>(counter.peak.load()),  // NOLINT
+                 static_cast<long long>(counter.total.load()));  // NOLINT
+        *out << line;
+    }
+    snprintf(line, sizeof(line), "%-18s %14lld %14lld %14lld\n",
+             "Vector bytes",
+             static_cast<long long>(this->bytes_.live.load()),  // NOLINT
+             static_cast<long long>(this->bytes_.peak.load()),  // NOLINT
+             static_cast<long long>(this->bytes_.total.load()));  // NOLINT
+    *out << line;
+}
+
+MemoryStats &MemoryStats::get() {
+    static MemoryStats stats;
+    return stats;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
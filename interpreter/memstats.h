@@ -0,0 +1,155 @@
+/* Statistics of memory used by values.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMSTATS_H_
+#define MEMSTATS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "column.h"
+
+/**
+ * @brief Counters of sequences and vector buffers, collected with
+ * `--mem-stats'.
+ *
+ * Scalars are stored inside of values and are never allocated, so only
+ * sequence objects of each kind and arrays of vector elements are counted.
+ * Counters are updated by all threads.  When statistics are disabled, the
+ * only cost is a check of a flag.
+ */
+class MemoryStats {
+ public:
+    enum Kind {
+        kVector,
+        kRange,
+        kKindsCount,
+    };
+
+ private:
+    struct Counter {
+        std::atomic<int64_t> live;
+        std::atomic<int64_t> peak;
+        std::atomic<int64_t> total;
+
+        Counter() : live(0), peak(0), total(0) { }
+
+        void add(int64_t amount);
+
+        void remove(int64_t amount) {
+            this->live.fetch_sub(amount, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * @brief Summary of a statement.
+     */
+    struct Line {
+        int line;
+        /* Sequences created and bytes of buffers allocated by the
+         * statement.  */
+        int64_t objects;
+        int64_t bytes;
+        /* Bytes of buffers that are alive after the statement, and the most
+         * that were alive during it.  */
+        int64_t live;
+        int64_t peak;
+        std::string largestVariable;
+        int64_t largestBytes;
+    };
+
+    static bool enabled_;
+
+    Counter objects_[kKindsCount];
+    Counter bytes_;
+    /* Peak of live bytes since the start of the current statement.  */
+    std::atomic<int64_t> statementPeak_;
+    /* Totals at the start of the current statement.  */
+    int64_t startObjects_;
+    int64_t startBytes_;
+    std::vector<Line> lines_;
+
+    MemoryStats() : statementPeak_(0), startObjects_(0), startBytes_(0) { }
+
+    void addBytes(int64_t bytes);
+
+    void removeBytes(int64_t bytes) {
+        this->bytes_.remove(bytes);
+    }
+
+    int64_t getTotalObjects() const;
+
+ public:
+    MemoryStats(const MemoryStats&) = delete;
+    MemoryStats &operator=(const MemoryStats&) = delete;
+
+    static void enable() {
+        enabled_ = true;
+    }
+
+    static bool isEnabled() {
+        return enabled_;
+    }
+
+    static void objectCreated(Kind kind) {
+        if (enabled_) {
+            get().objects_[kind].add(1);
+        }
+    }
+
+    static void objectDestroyed(Kind kind) {
+        if (enabled_) {
+            get().objects_[kind].remove(1);
+        }
+    }
+
+    /**
+     * @brief Take ownership of a filled column of a vector.  Its buffers are
+     * counted until the last reference to the column is gone.
+     */
+    static std::shared_ptr<const Column> track(Column *column);
+
+    /**
+     * @brief Start counting allocations of a statement.
+     */
+    void beginStatement();
+
+    /**
+     * @brief Remember allocations of a statement.
+     *
+     * @param largestVariable Variable that holds the most memory after the
+     * statement, empty if there are no sequences in variables.
+     */
+    void endStatement(int line, const std::string &largestVariable,
+                      int64_t largestBytes);
+
+    /**
+     * @brief Print summary of each statement and totals.
+     */
+    void report(std::ostream *out) const;
+
+    static MemoryStats &get();
+};
+
+#endif  // MEMSTATS_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
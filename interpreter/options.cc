@@ -0,0 +1,207 @@
+/* Interpreter settings selected with command line arguments.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "options.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <thread> // NOLINT
+
+/**
+ * @brief Parse a positive integer.
+ * @returns false if the string is not a positive integer.
+ */
+static bool parsePositive(const std::string &str, int *result) {
+    if (str.empty() || str.find_first_not_of("0123456789") != str.npos) {
+        return false;
+    }
+    try {
+        *result = std::stoi(str);
+    } catch (std::out_of_range &) {
+        return false;
+    }
+    return *result > 0;
+}
+
+bool Options::parse(int argc, char *argv[]) {
+    static const std::string threadsArg = "--threads=";
+    static const std::string profileArg = "--profile=";
+    static const std::string memStatsArg = "--mem-stats=";
+    static const std::string memoryBudgetArg = "--memory-budget=";
+    static const std::string cacheArg = "--cache=";
+    static const std::string serverArg = "--server=";
+
+    auto threadsEnv = getenv("INTERPRETER_THREADS");
+    if (threadsEnv != nullptr && !parsePositive(threadsEnv, &this->threads)) {
+        return false;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        if (arg.compare(0, threadsArg.size(), threadsArg) == 0) {
+            if (!parsePositive(arg.substr(threadsArg.size()),
+                               &this->threads)) {
+                return false;
+            }
+        } else if (arg == "--simd=avx2") {
+            this->simd = Kernels::kAvx2;
+        } else if (arg == "--simd=sse2") {
+            this->simd = Kernels::kSse2;
+        } else if (arg == "--simd=none") {
+            this->simd = Kernels::kGeneric;
+        } else if (arg == "--closed-form=on") {
+            this->closedForm = kClosedFormOn;
+        } else if (arg == "--closed-form=off") {
+            this->closedForm = kClosedFormOff;
+        } else if (arg == "--closed-form=trace") {
+            this->closedForm = kClosedFormTrace;
+        } else if (arg == "--float-sum=pairwise") {
+            this->summation = kPairwiseSummation;
+        } else if (arg == "--float-sum=kahan") {
+            this->summation = kKahanSummation;
+        } else if (arg == "--jit") {
+            this->jit = true;
+        } else if (arg == "--parallel-parse=on") {
+            this->parallelParse = true;
+        } else if (arg == "--parallel-parse=off") {
+            this->parallelParse = false;
+        } else if (arg == "--profile") {
+            this->profile = true;
+        } else if (arg.compare(0, profileArg.size(), profileArg) == 0 &&
+                   arg.size() > profileArg.size()) {
+            this->profile = true;
+            this->profileFile = arg.substr(profileArg.size());
+        } else if (arg.compare(0, memoryBudgetArg.size(),
+                               memoryBudgetArg) == 0) {
+            int megabytes;
+            if (!parsePositive(arg.substr(memoryBudgetArg.size()),
+                               &megabytes)) {
+                return false;
+            }
+            this->memoryBudget = static_cast<size_t>(megabytes) << 20;
+        } else if (arg.compare(0, cacheArg.size(), cacheArg) == 0 &&
+                   arg.size() > cacheArg.size()) {
+            this->cacheDir = arg.substr(cacheArg.size());
+        } else if (arg == "--server") {
+            this->server = true;
+        } else if (arg.compare(0, serverArg.size(), serverArg) == 0 &&
+                   arg.size() > serverArg.size()) {
+            this->server = true;
+            this->serverSocket = arg.substr(serverArg.size());
+        } else if (arg == "--mem-stats") {
+            this->memStats = true;
+        } else if (arg.compare(0, memStatsArg.size(), memStatsArg) == 0 &&
+                   arg.size() > memStatsArg.size()) {
+            this->memStats = true;
+            this->memStatsFile = arg.substr(memStatsArg.size());
+        } else if (arg == "--dump-ast") {
+            this->dumpAst = true;
+        } else if (arg == "--engine=tree") {
+            this->engine = kTreeWalker;
+        } else if (arg == "--engine=vm") {
+            this->engine = kBytecode;
+        } else if (arg[0] != '-' && this->script.empty()) {
+            this->script = arg;
+        } else {
+            return false;
+        }
+    }
+
+    /* Bytecode and native code don't have nodes to time.  */
+    if (this->profile) {
+        this->engine = kTreeWalker;
+        this->jit = false;
+    }
+    return true;
+}
+
+void Options::printUsage(std::ostream *out, const char *program) {
+    *out << "Usage: " << program << " [options] < program" << std::endl
+         << "       " << program << " [options] program" << std::endl
+         << "Options:" << std::endl
+         << "  --cache=DIR       Keep results of var statements in DIR and"
+         << " reuse them on" << std::endl
+         << "                    the next run, if neither the statement nor"
+         << " its inputs" << std::endl
+         << "                    have changed." << std::endl
+         << "  --closed-form=on|off|trace" << std::endl
+         << "                    Compute sums and products of ranges with"
+         << " formulas (default" << std::endl
+         << "                    is on), trace prints a note when this"
+         << " happens." << std::endl
+         << "  --dump-ast        Print syntax tree of each statement after"
+         << " optimization" << std::endl
+         << "                    to standard error." << std::endl
+         << "  --engine=tree|vm  Evaluate expressions by walking the syntax"
+         << " tree or" << std::endl
+         << "                    with the bytecode virtual machine (default)."
+         << std::endl
+         << "  --float-sum=pairwise|kahan" << std::endl
+         << "                    Summation algorithm for floats in parallel"
+         << " reduce (default" << std::endl
+         << "                    is pairwise)." << std::endl
+         << "  --mem-stats[=FILE]" << std::endl
+         << "                    Print sequences and bytes of vectors"
+         << " allocated by each" << std::endl
+         << "                    statement at exit, to standard error or"
+         << " to FILE." << std::endl
+         << "  --memory-budget=MB" << std::endl
+         << "                    Keep at most this many megabytes of vectors"
+         << " in memory, put" << std::endl
+         << "                    larger vectors into temporary files in"
+         << " TMPDIR." << std::endl
+         << "  --parallel-parse=on|off" << std::endl
+         << "                    Parse large program files on all threads"
+         << " before running" << std::endl
+         << "                    them (default is on)." << std::endl
+         << "  --profile[=FILE]  Print time and number of calls of each"
+         << " statement and" << std::endl
+         << "                    expression at exit, to standard error or"
+         << " to FILE." << std::endl
+         << "  --server[=SOCKET] Run programs sent by clients over standard"
+         << " input or a UNIX" << std::endl
+         << "                    domain socket, each in a new context."
+         << std::endl
+         << "  --threads=N       Number of threads for map and reduce, all CPUs"
+         << " by default." << std::endl
+         << "                    Can also be set with INTERPRETER_THREADS"
+         << " variable." << std::endl
+         << "  --jit             Compile lambdas into native code, if"
+         << " possible." << std::endl
+         << "  --simd=avx2|sse2|none" << std::endl
+         << "                    Best instruction set for vector arithmetic,"
+         << " if supported" << std::endl
+         << "                    by CPU (default is avx2)." << std::endl;
+}
+
+int Options::getThreadsCount() const {
+    if (this->threads > 0) {
+        return this->threads;
+    }
+    /* hardware_concurrency() is allowed to return 0 if it can't tell.  */
+    return std::max<int>(std::thread::hardware_concurrency(), 1);
+}
+
+Options &Options::get() {
+    static Options options;
+    return options;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
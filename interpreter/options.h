@@ -0,0 +1,175 @@
+/* Interpreter settings selected with command line arguments.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+
+#include <stddef.h>
+
+#include <ostream>
+#include <string>
+
+#include "kernels.h"
+
+/**
+ * @brief Process-wide interpreter settings.
+ *
+ * Settings are parsed once at startup and are only read afterwards, so they
+ * can be accessed from any thread without synchronization.
+ */
+class Options {
+ public:
+    enum Engine {
+        kTreeWalker,
+        kBytecode,
+    };
+
+    /**
+     * @brief How expressions are evaluated.  Tree walker is a reference
+     * implementation, bytecode is the default.
+     */
+    Engine engine;
+
+    /**
+     * @brief Number of threads used by parallel operations, 0 to use all
+     * available CPUs.
+     */
+    int threads;
+
+    /**
+     * @brief Print optimized tree of each statement before executing it.
+     */
+    bool dumpAst;
+
+    /**
+     * @brief Best instruction set allowed for vector arithmetic kernels.
+     */
+    Kernels::InstructionSet simd;
+
+    enum ClosedFormMode {
+        kClosedFormOff,
+        kClosedFormOn,
+        kClosedFormTrace,
+    };
+
+    /**
+     * @brief Whether reductions of ranges are computed with formulas when
+     * possible.  In trace mode a note is printed each time this happens.
+     */
+    ClosedFormMode closedForm;
+
+    enum Summation {
+        kPairwiseSummation,
+        kKahanSummation,
+    };
+
+    /**
+     * @brief How parallel reductions sum floating point numbers.
+     */
+    Summation summation;
+
+    /**
+     * @brief Compile lambdas into native code.
+     */
+    bool jit;
+
+    /**
+     * @brief Parse lines of a program file on multiple threads before
+     * executing them.
+     */
+    bool parallelParse;
+
+    /**
+     * @brief Measure execution of each statement and expression node, and
+     * print the report at exit.  Profiled programs are always evaluated by
+     * the tree walker, so that each node can be timed.
+     */
+    bool profile;
+
+    /**
+     * @brief File to write the profile to, empty for standard error.
+     */
+    std::string profileFile;
+
+    /**
+     * @brief Bytes of vector elements kept on the heap, after that large
+     * vectors are allocated in spill files.  0 means no limit.
+     */
+    size_t memoryBudget;
+
+    /**
+     * @brief Directory where results of `var' statements are kept between
+     * runs, empty if results aren't cached.
+     */
+    std::string cacheDir;
+
+    /**
+     * @brief Run programs sent by clients, instead of a single program.
+     */
+    bool server;
+
+    /**
+     * @brief UNIX domain socket the server listens on, empty to read
+     * requests from standard input.
+     */
+    std::string serverSocket;
+
+    /**
+     * @brief Count sequences and bytes of vectors, and print a summary of
+     * each statement at exit.
+     */
+    bool memStats;
+
+    /**
+     * @brief File to write memory statistics to, empty for standard error.
+     */
+    std::string memStatsFile;
+
+    /**
+     * @brief Path of the program file, empty if program is read from
+     * standard input.
+     */
+    std::string script;
+
+    Options()
+        : engine(kBytecode), threads(0), dumpAst(false),
+          simd(Kernels::kAvx2), closedForm(kClosedFormOn),
+          summation(kPairwiseSummation), jit(false), parallelParse(true),
+          profile(false), profileFile(), memoryBudget(0), cacheDir(),
+          server(false), serverSocket(), memStats(false), memStatsFile(),
+          script() { }
+
+    /**
+     * @brief Read settings from environment variables and command line
+     * arguments.  Arguments take precedence over the environment.
+     * @returns false if settings are not valid.
+     */
+    bool parse(int argc, char *argv[]);
+
+    /**
+     * @brief Number of threads with the default resolved.
+     */
+    int getThreadsCount() const;
+
+    static void printUsage(std::ostream *out, const char *program);
+
+    static Options &get();
+};
+
+#endif  // OPTIONS_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,200 @@
+/* Buffered writer of program output.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <iostream>
+
+/* Integers are at most 11 characters long with the sign, and doubles below
+ * 2^53 are at most 16 digits, sign and 7 characters of fraction.  */
+static const size_t maxNumberLength = 32;
+
+/* Doubles with larger magnitude are formatted with snprintf().  */
+static const double maxShortFloat = 9007199254740992.0;
+
+static const char digitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/**
+ * @brief Format unsigned number without leading zeros.
+ * @returns Pointer past the last written character.
+ */
+static char *formatUnsigned(uint64_t value, char *out) {
+    char digits[20];
+    char *p = digits + sizeof(digits);
+    while (value >= 100) {
+        auto pair = value % 100 * 2;
+        value /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digitPairs[value * 2 + 1];
+        *--p = digitPairs[value * 2];
+    } else {
+        *--p = '0' + value;
+    }
+    auto length = digits + sizeof(digits) - p;
+    memcpy(out, p, length);
+    return out + length;
+}
+
+Output::Output(int fd)
+    : fd_(fd), pipe_(false), buffer_(new char[kBufferSize]), used_(0),
+      outputSink_(), errorSink_() {
+    struct stat st;
+    this->pipe_ = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+Output::~Output() {
+    this->flush();
+    delete[] this->buffer_;
+}
+
+void Output::writeInteger(int value) {
+    char *start = this->reserve(maxNumberLength);
+    char *p = start;
+    uint64_t magnitude = value;
+    if (value < 0) {
+        *p++ = '-';
+        magnitude = -static_cast<int64_t>(value);
+    }
+    p = formatUnsigned(magnitude, p);
+    this->used_ += p - start;
+}
+
+void Output::writeFloat(double value) {
+    /* Values with magnitude below 2^53 are m * 2^e with integer m < 2^53 and
+     * e < 0 (or integers), so value * 10^6 is computed exactly in 128 bits
+     * and rounded half to even, like printf() does.  */
+    if (std::isfinite(value) && std::fabs(value) < maxShortFloat) {
+        int exponent;
+        auto mantissa = static_cast<uint64_t>(
+                std::ldexp(std::fabs(std::frexp(value, &exponent)), 53));
+        exponent -= 53;
+
+        typedef unsigned __int128 uint128_t;
+        uint128_t scaled = static_cast<uint128_t>(mantissa) * 1000000;
+        uint128_t micros;
+        if (exponent >= 0) {
+            micros = scaled << exponent;
+        } else if (exponent > -100) {
+            int shift = -exponent;
+            uint128_t half = static_cast<uint128_t>(1) << (shift - 1);
+            uint128_t rest = scaled & ((half << 1) - 1);
+            micros = scaled >> shift;
+            if (rest > half || (rest == half && micros % 2 == 1)) {
+                micros++;
+            }
+        } else {
+            /* Less than 2^-47, that is 0.000000 after rounding.  */
+            micros = 0;
+        }
+
+        char *start = this->reserve(maxNumberLength);
+        char *p = start;
+        if (std::signbit(value)) {
+            *p++ = '-';
+        }
+        p = formatUnsigned(static_cast<uint64_t>(micros / 1000000), p);
+        *p++ = '.';
+        auto fraction = static_cast<uint32_t>(micros % 1000000);
+        for (int i = 5; i >= 0; i--) {
+            p[i] = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        this->used_ += p + 6 - start;
+        return;
+    }
+
+    /* Same as std::to_string(), but without an allocation.  Largest double
+     * has 309 digits before the point.  */
+    char s[512];
+    auto length = snprintf(s, sizeof(s), "%f", value);
+    this->write(s, length);
+}
+
+void Output::writeDirect(const char *s, size_t size) {
+    if (this->outputSink_) {
+        if (size > 0) {
+            this->outputSink_(s, size);
+        }
+        return;
+    }
+    while (size > 0) {
+        auto written = ::write(this->fd_, s, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* Nowhere to report the error, so output is dropped, like
+             * std::cout does.  */
+            return;
+        }
+        s += written;
+        size -= written;
+    }
+}
+
+void Output::flush() {
+    std::lock_guard<std::mutex> lock(this->flushMutex_);
+    this->writeDirect(this->buffer_, this->used_);
+    this->used_ = 0;
+}
+
+void Output::writeError(const std::string &text) {
+    /* Lock is held while the error is written as well, so errors written by
+     * different threads don't mix.  */
+    std::lock_guard<std::mutex> lock(this->flushMutex_);
+    this->writeDirect(this->buffer_, this->used_);
+    this->used_ = 0;
+    if (this->errorSink_) {
+        this->errorSink_(text.data(), text.size());
+    } else {
+        std::cerr << text << std::flush;
+    }
+}
+
+void Output::redirect(const Sink &output, const Sink &errors) {
+    this->flush();
+    std::lock_guard<std::mutex> lock(this->flushMutex_);
+    this->outputSink_ = output;
+    this->errorSink_ = errors;
+}
+
+Output &Output::get() {
+    static Output output(STDOUT_FILENO);
+    return output;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
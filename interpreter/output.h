@@ -0,0 +1,137 @@
+/* Buffered writer of program output.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stddef.h>
+#include <string.h>
+
+#include <functional>
+#include <mutex> // NOLINT
+#include <string>
+
+/**
+ * @brief Writer of program output to standard output.
+ *
+ * Output is formatted right into a fixed buffer, that is written to the file
+ * descriptor with write(2) when it fills up, so printing of a sequence never
+ * builds the whole string in memory.  Numbers are formatted the same way as
+ * std::to_string() does.
+ *
+ * Output is written only by the main thread.  Everything that writes to
+ * standard error must call flush() first, so that messages appear after the
+ * output that preceded them.
+ *
+ * In server mode output and errors are passed to functions that send them
+ * to the client instead.
+ */
+class Output {
+ public:
+    typedef std::function<void(const char*, size_t)> Sink;
+
+ private:
+    static const size_t kBufferSize = 1 << 20;
+
+    int fd_;
+    bool pipe_;
+    char *buffer_;
+    size_t used_;
+    std::mutex flushMutex_;
+    Sink outputSink_;
+    Sink errorSink_;
+
+    explicit Output(int fd);
+
+    /**
+     * @brief Make sure that at least `size' bytes are free in the buffer.
+     */
+    char *reserve(size_t size) {
+        if (size > kBufferSize - this->used_) {
+            this->flush();
+        }
+        return this->buffer_ + this->used_;
+    }
+
+ public:
+    ~Output();
+
+    Output(const Output&) = delete;
+    Output &operator=(const Output&) = delete;
+
+    void write(const char *s, size_t size) {
+        if (size > kBufferSize - this->used_) {
+            this->flush();
+            if (size > kBufferSize) {
+                this->writeDirect(s, size);
+                return;
+            }
+        }
+        memcpy(this->buffer_ + this->used_, s, size);
+        this->used_ += size;
+    }
+
+    void write(const std::string &s) {
+        this->write(s.data(), s.size());
+    }
+
+    void writeInteger(int value);
+
+    void writeFloat(double value);
+
+    /**
+     * @brief Write all of [s, s + size) to the file descriptor, bypassing
+     * the buffer.
+     */
+    void writeDirect(const char *s, size_t size);
+
+    /**
+     * @brief Write buffered output to the file descriptor.  Can be called
+     * from any thread.
+     */
+    void flush();
+
+    /**
+     * @brief Write an error message after the output written so far, to
+     * standard error or to the error sink.  Can be called from any thread.
+     */
+    void writeError(const std::string &text);
+
+    /**
+     * @brief Pass output and errors to the functions instead of writing them
+     * to standard output and standard error.  Empty functions restore the
+     * standard streams.  Buffered output is flushed first.
+     */
+    void redirect(const Sink &output, const Sink &errors);
+
+    /**
+     * @brief Whether output goes to a pipe, that is read by another program
+     * while this one runs.
+     */
+    bool isPipe() const {
+        return this->pipe_;
+    }
+
+    /**
+     * @brief Get the writer of standard output.
+     */
+    static Output &get();
+};
+
+#endif  // OUTPUT_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -14,7 +14,18 @@
 
 int yyerror(const YYLTYPE *loc, Statement **statement, yyscan_t scanner,
         const char *msg) {
-    user_error(loc, std::string(msg));
+    return user_error(loc, std::string(msg));
+}
+
+static std::string toString(const TokenText &token) {
+    return std::string(token.text, token.length);
+}
+
+/* Remember where expression starts, or where its operator is, for the
+ * profiler.  */
+static Expression *located(const YYLTYPE &loc, Expression *expr) {
+    expr->setLocation(loc.first_line, loc.first_column);
+    return expr;
 }
 
 %}
@@ -26,6 +37,13 @@ int yyerror(const YYLTYPE *loc, Statement **statement, yyscan_t scanner,
 typedef void* yyscan_t;
 #endif
 
+/* Identifier is passed as a slice of the line being parsed, which stays in
+ * place until the parser is done with it.  */
+struct TokenText {
+    const char *text;
+    int length;
+};
+
 }
 
 %output  "parser.cc"
@@ -44,7 +62,7 @@ typedef void* yyscan_t;
     char *strvalue;
     Expression *expression;
     Statement *statement;
-    char *identifier;
+    TokenText identifier;
 }
 
 %left '+' TOKEN_PLUS
@@ -75,10 +93,14 @@ typedef void* yyscan_t;
 %token TOKEN_PRINT
 %token TOKEN_REDUCE
 %token TOKEN_VAR
+%token TOKEN_SAVE
+%token TOKEN_LOAD
 
 %type <expression> expr
 %type <statement> stmt
 
+%destructor { free($$); } <strvalue>
+
 %%
 
 input
@@ -88,35 +110,61 @@ input
 
 stmt
     : TOKEN_OUT expr[E] { $$ = new OutStatement($E); }
-    | TOKEN_PRINT TOKEN_STRING[S] { $$ = new PrintStatement(std::string($S)); }
+    | TOKEN_PRINT TOKEN_STRING[S] {
+        $$ = new PrintStatement(std::string($S));
+        free($S);
+    }
     | TOKEN_VAR TOKEN_IDENTIFIER[I] TOKEN_ASSIGN expr[E] {
-        $$ = new VarStatement(std::string($I), $E);
+        $$ = new VarStatement(toString($I), $E);
+    }
+    | TOKEN_SAVE TOKEN_STRING[S] expr[E] {
+        $$ = new SaveStatement(std::string($S), $E);
+        free($S);
     }
     ;
 
 expr
-    : expr[L] TOKEN_PLUS expr[R] { $$ = new AddExpression($L, $R); }
-    | expr[L] TOKEN_MINUS expr[R] { $$ = new SubExpression($L, $R); }
-    | expr[L] TOKEN_MULTIPLY expr[R] { $$ = new MulExpression($L, $R); }
-    | expr[L] TOKEN_DIVIDE expr[R] { $$ = new DivExpression($L, $R); }
-    | expr[L] TOKEN_POW expr[R] { $$ = new PowExpression($L, $R); }
+    : expr[L] TOKEN_PLUS[O] expr[R] {
+        $$ = located(@O, new AddExpression($L, $R));
+    }
+    | expr[L] TOKEN_MINUS[O] expr[R] {
+        $$ = located(@O, new SubExpression($L, $R));
+    }
+    | expr[L] TOKEN_MULTIPLY[O] expr[R] {
+        $$ = located(@O, new MulExpression($L, $R));
+    }
+    | expr[L] TOKEN_DIVIDE[O] expr[R] {
+        $$ = located(@O, new DivExpression($L, $R));
+    }
+    | expr[L] TOKEN_POW[O] expr[R] {
+        $$ = located(@O, new PowExpression($L, $R));
+    }
     | TOKEN_LPAREN expr[E] TOKEN_RPAREN { $$ = $E; }
-    | TOKEN_NUMBER { $$ = new ValueExpression(ScalarValue($1));}
-    | TOKEN_FLOAT_NUMBER { $$ = new ValueExpression(ScalarValue($1)); }
-    | TOKEN_IDENTIFIER { $$ = new IdentifierExpression(std::string($1)); }
+    | TOKEN_NUMBER { $$ = located(@$, new ValueExpression(Value($1))); }
+    | TOKEN_FLOAT_NUMBER {
+        $$ = located(@$, new ValueExpression(Value($1)));
+    }
+    | TOKEN_IDENTIFIER {
+        $$ = located(@$, new IdentifierExpression(toString($1)));
+    }
+    | TOKEN_LOAD TOKEN_STRING[S] {
+        $$ = located(@$, new LoadExpression(std::string($S)));
+        free($S);
+    }
     | TOKEN_LCURLY expr[B] TOKEN_COMMA expr[E] TOKEN_RCURLY {
-        $$ = new RangeExpression($B, $E);
+        $$ = located(@$, new RangeExpression($B, $E));
     }
     | TOKEN_MAP TOKEN_LPAREN expr[E] TOKEN_COMMA TOKEN_IDENTIFIER[I]
         TOKEN_LAMBDA expr[L] TOKEN_RPAREN {
-        $$ = new MapExpression($E, $I, $L);
+        $$ = located(@$, new MapExpression($E, toString($I), $L));
     }
     | TOKEN_REDUCE TOKEN_LPAREN
         expr[E] TOKEN_COMMA
         expr[D] TOKEN_COMMA
         TOKEN_IDENTIFIER[L] TOKEN_IDENTIFIER[R] TOKEN_LAMBDA expr[F]
         TOKEN_RPAREN {
-        $$ = new ReduceExpression($E, $D, $L, $R, $F);
+        $$ = located(@$, new ReduceExpression($E, $D, toString($L),
+                                              toString($R), $F));
     }
     ;
 
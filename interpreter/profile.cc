@@ -0,0 +1,110 @@
+/* Profiler of statements and expressions.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profile.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <chrono> // NOLINT
+#include <string>
+
+static thread_local Profile::Site *currentSite = nullptr;
+
+static uint64_t wallTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t cpuTime(Profile::Clock clock) {
+    struct timespec ts;
+    switch (clock) {
+    case Profile::kProcessClock:
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        break;
+    case Profile::kThreadClock:
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        break;
+    default:
+        return 0;
+    }
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Profile::Timer::start() {
+    this->previous_ = currentSite;
+    currentSite = this->site_;
+    this->cpuStart_ = cpuTime(this->site_->clock);
+    this->wallStart_ = wallTime();
+}
+
+void Profile::Timer::stop() {
+    auto site = this->site_;
+    auto wall = wallTime() - this->wallStart_;
+    auto cpu = wall;
+    if (site->clock != kWallClock) {
+        cpu = cpuTime(site->clock) - this->cpuStart_;
+    }
+    site->calls.fetch_add(1, std::memory_order_relaxed);
+    site->wallNs.fetch_add(wall, std::memory_order_relaxed);
+    site->cpuNs.fetch_add(cpu, std::memory_order_relaxed);
+    currentSite = this->previous_;
+}
+
+Profile::Site *Profile::addSite(int line, int column, int depth,
+                                const std::string &name, Clock clock) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->sites_.emplace_back(line, column, depth, name, clock);
+    return &this->sites_.back();
+}
+
+void Profile::countElements(uint64_t count) {
+    if (currentSite != nullptr) {
+        currentSite->elements.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
+void Profile::report(std::ostream *out) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %12s %12s %12s %14s  %s\n",
+             "Location", "Wall ms", "CPU ms", "Calls", "Elements", "Node");
+    *out << "Profile:" << std::endl << line;
+    for (auto &&site : this->sites_) {
+        char location[32];
+        if (site.column < 0) {
+            snprintf(location, sizeof(location), "%d", site.line);
+        } else {
+            snprintf(location, sizeof(location), "%d,%d", site.line,
+                     site.column);
+        }
+        snprintf(line, sizeof(line), "%-10s %12.3f %12.3f %12llu %14llu  ",
+                 location, site.wallNs.load() / 1e6, site.cpuNs.load() / 1e6,
+                 static_cast<unsigned long long>(site.calls.load()),  // NOLINT
+                 static_cast<unsigned long long>(  // NOLINT
+                     site.elements.load()));
+        *out << line << std::string(site.depth * 2, ' ') << site.name
+             << std::endl;
+    }
+}
+
+Profile &Profile::get() {
+    static Profile profile;
+    return profile;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
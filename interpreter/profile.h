@@ -0,0 +1,139 @@
+/* Profiler of statements and expressions.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex> // NOLINT
+#include <ostream>
+#include <string>
+
+/**
+ * @brief Execution profile of the program, collected with `--profile'.
+ *
+ * Each statement and each node of its expression tree, including nodes of
+ * lambdas, is registered as a site.  Sites keep their counters after the
+ * syntax tree is deleted, so the report can be printed at exit.  Counters
+ * are updated by all threads that evaluate a node, so calls of a lambda on
+ * workers of the pool are added up.
+ */
+class Profile {
+ public:
+    enum Clock {
+        /* CPU time of all threads, for statements.  */
+        kProcessClock,
+        /* CPU time of the thread that evaluates a node.  */
+        kThreadClock,
+        /* Only wall time is measured.  Reading a CPU clock takes longer
+         * than evaluating a typical node of a lambda, so in lambdas CPU time
+         * is the wall time spent on the thread.  */
+        kWallClock,
+    };
+
+    struct Site {
+        int line;
+        /* -1 for statements.  */
+        int column;
+        /* Nesting depth of the node in the statement tree.  */
+        int depth;
+        std::string name;
+        Clock clock;
+        std::atomic<uint64_t> calls;
+        /* Elements of sequences that were produced or consumed.  */
+        std::atomic<uint64_t> elements;
+        std::atomic<uint64_t> wallNs;
+        std::atomic<uint64_t> cpuNs;
+
+        Site(int line, int column, int depth, const std::string &name,
+             Clock clock)
+            : line(line), column(column), depth(depth), name(name),
+              clock(clock), calls(0), elements(0), wallNs(0), cpuNs(0) { }
+    };
+
+    /**
+     * @brief Measure time from creation to destruction of the object and
+     * count a call of the site.  Does nothing if the site is nullptr.
+     *
+     * Site is the current one of the thread while the timer exists, so that
+     * countElements() adds to it.
+     */
+    class Timer {
+     private:
+        Site *site_;
+        Site *previous_;
+        uint64_t wallStart_;
+        uint64_t cpuStart_;
+
+        void start();
+        void stop();
+
+     public:
+        explicit Timer(Site *site) : site_(site) {
+            if (site != nullptr) {
+                this->start();
+            }
+        }
+
+        ~Timer() {
+            if (this->site_ != nullptr) {
+                this->stop();
+            }
+        }
+
+        Timer(const Timer&) = delete;
+        Timer &operator=(const Timer&) = delete;
+    };
+
+ private:
+    /* Deque doesn't move elements, so sites can be referenced by nodes.  */
+    std::deque<Site> sites_;
+    std::mutex mutex_;
+
+    Profile() { }
+
+ public:
+    Profile(const Profile&) = delete;
+    Profile &operator=(const Profile&) = delete;
+
+    /**
+     * @brief Register a statement or a node.  Sites are reported in order
+     * of registration, so a node should be added before its children.
+     */
+    Site *addSite(int line, int column, int depth, const std::string &name,
+                  Clock clock);
+
+    /**
+     * @brief Add elements to the site of the innermost timer of this thread,
+     * if there is one.
+     */
+    static void countElements(uint64_t count);
+
+    /**
+     * @brief Print a table of sites, nodes are indented by depth.
+     */
+    void report(std::ostream *out);
+
+    static Profile &get();
+};
+
+#endif  // PROFILE_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
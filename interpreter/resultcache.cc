@@ -0,0 +1,202 @@
+/* Cache of results of statements.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultcache.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "options.h"
+#include "vectorfile.h"
+
+/* Changed when the meaning of keys changes, so old results aren't used.  */
+static const uint64_t kVersion = 1;
+
+/**
+ * @brief Continue FNV-1a hash with bytes.
+ */
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t hashValue(uint64_t hash, uint64_t value) {
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+/**
+ * @brief Add identity of a file to the hash, so that a statement that loads
+ * the file is computed again when the file changes.
+ */
+static uint64_t hashFile(uint64_t hash, const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return hashValue(hash, 0);
+    }
+    hash = hashValue(hash, st.st_ino);
+    hash = hashValue(hash, st.st_size);
+    hash = hashValue(hash, st.st_mtim.tv_sec);
+    return hashValue(hash, st.st_mtim.tv_nsec);
+}
+
+static bool isIdentifierChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+ResultCache::ResultCache(const std::string &dir)
+        : dir_(dir), slotKeys_(), used_(), seed_(14695981039346656037ULL) {
+    auto &options = Options::get();
+    this->seed_ = hashValue(this->seed_, kVersion);
+    this->seed_ = hashValue(this->seed_, options.summation);
+    this->seed_ = hashValue(this->seed_, options.simd);
+    this->seed_ = hashValue(this->seed_,
+                            options.closedForm != Options::kClosedFormOff);
+}
+
+std::string ResultCache::getPath(uint64_t key, bool scalar) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.%s",
+             static_cast<unsigned long long>(key),  // NOLINT
+             scalar ? "scalar" : "vec");
+    return this->dir_ + name;
+}
+
+uint64_t ResultCache::getKey(const char *text, size_t size,
+                             const Context &ctx) const {
+    auto key = hashBytes(this->seed_, text, size);
+
+    /* Statement isn't parsed again, names are picked from the text the same
+     * way the lexer does it.  Names of lambda parameters and keywords can
+     * match variables as well, that only makes the statement depend on more
+     * statements than it really does.  */
+    size_t i = 0;
+    while (i < size && text[i] != '#') {
+        if (text[i] == '"') {
+            auto end = static_cast<const char*>(
+                memchr(text + i + 1, '"', size - i - 1));
+            if (end == nullptr) {
+                break;
+            }
+            key = hashFile(key, std::string(text + i + 1, end));
+            i = end - text + 1;
+        } else if (isdigit(static_cast<unsigned char>(text[i]))) {
+            while (i < size && isdigit(static_cast<unsigned char>(text[i]))) {
+                i++;
+            }
+        } else if (isIdentifierChar(text[i])) {
+            auto start = i;
+            while (i < size && isIdentifierChar(text[i])) {
+                i++;
+            }
+            auto slot = ctx.find(std::string(text + start, i - start));
+            if (slot >= 0 &&
+                    static_cast<size_t>(slot) < this->slotKeys_.size()) {
+                key = hashValue(key, this->slotKeys_[slot]);
+            }
+        } else {
+            i++;
+        }
+    }
+    return key;
+}
+
+bool ResultCache::find(uint64_t key, Value *value) {
+    try {
+        auto path = this->getPath(key, false);
+        bool scalar = access(path.c_str(), F_OK) != 0;
+        if (scalar) {
+            path = this->getPath(key, true);
+            if (access(path.c_str(), F_OK) != 0) {
+                return false;
+            }
+        }
+        *value = VectorFile::load(path);
+        if (scalar) {
+            if (value->getSize() != 1) {
+                return false;
+            }
+            *value = value->getSequence()->getItem(0);
+        }
+    } catch (std::exception &) {
+        return false;
+    }
+    this->used_.insert(key);
+    return true;
+}
+
+void ResultCache::store(uint64_t key, const Value &value) {
+    try {
+        if (value.isScalar()) {
+            auto column = new Column(value.isScalarFloat() ? Column::kFloat
+                                                           : Column::kInteger);
+            if (value.isScalarFloat()) {
+                column->pushFloat(value.asFloat());
+            } else {
+                column->pushInteger(value.asInteger());
+            }
+            VectorFile::save(this->getPath(key, true),
+                             Value(new VectorValue(column)));
+        } else {
+            VectorFile::save(this->getPath(key, false), value);
+        }
+    } catch (std::exception &) {
+        return;
+    }
+    this->used_.insert(key);
+}
+
+void ResultCache::setSlotKey(int slot, uint64_t key) {
+    if (static_cast<size_t>(slot) >= this->slotKeys_.size()) {
+        this->slotKeys_.resize(slot + 1);
+    }
+    this->slotKeys_[slot] = key;
+}
+
+void ResultCache::removeUnused() {
+    auto dir = opendir(this->dir_.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (auto entry = readdir(dir)) {
+        /* Only files named like results are touched.  */
+        unsigned long long key;  // NOLINT
+        char extension[8];
+        int length = 0;
+        if (sscanf(entry->d_name, "%16llx.%7[a-z]%n", &key, extension,
+                   &length) != 2 || entry->d_name[length] != '\0' ||
+                strlen(entry->d_name) != 16 + 1 + strlen(extension) ||
+                (strcmp(extension, "vec") != 0 &&
+                 strcmp(extension, "scalar") != 0)) {
+            continue;
+        }
+        if (this->used_.count(key) == 0) {
+            unlink((this->dir_ + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
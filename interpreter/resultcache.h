@@ -0,0 +1,89 @@
+/* Cache of results of statements.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESULTCACHE_H_
+#define RESULTCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "context.h"
+#include "value.h"
+
+/**
+ * @brief Results of `var' statements kept between runs with `--cache'.
+ *
+ * Each `var' statement gets a key, that is a hash of its text, of keys of
+ * the statements that defined variables it uses and of files it names.  So
+ * keys form a dependency graph: when a line is edited, keys of it and of the
+ * statements downstream of it change, while the rest find their results in
+ * the cache and aren't executed again.
+ *
+ * Results are stored in the directory in the format of `save', so cached
+ * vectors are mapped back without copying.  Scalars are stored as vectors of
+ * a single element.  Cache is an optimization, so errors of writing it are
+ * ignored and unreadable entries are computed again.
+ */
+class ResultCache {
+ private:
+    std::string dir_;
+    /* Key of the statement that set each slot of the context.  */
+    std::vector<uint64_t> slotKeys_;
+    /* Keys found or stored in this run.  */
+    std::unordered_set<uint64_t> used_;
+    /* Hash of options that can change results.  */
+    uint64_t seed_;
+
+    std::string getPath(uint64_t key, bool scalar) const;
+
+ public:
+    explicit ResultCache(const std::string &dir);
+
+    /**
+     * @brief Compute key of a statement.  Should be called before the
+     * statement is resolved, so that its identifiers refer to the variables
+     * it will read.
+     */
+    uint64_t getKey(const char *text, size_t size, const Context &ctx) const;
+
+    /**
+     * @brief Find result of a statement with the key.
+     * @returns false if there is no such result.
+     */
+    bool find(uint64_t key, Value *value);
+
+    void store(uint64_t key, const Value &value);
+
+    /**
+     * @brief Remember that the slot was set by the statement with the key.
+     */
+    void setSlotKey(int slot, uint64_t key);
+
+    /**
+     * @brief Delete results that weren't used by this run, so that the
+     * directory only keeps results of the last run of the program.
+     */
+    void removeUnused();
+};
+
+#endif  // RESULTCACHE_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,262 @@
+/* Server that runs programs sent by clients.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "output.h"
+
+/**
+ * @brief Writer of frames to a client.  When the client goes away, the rest
+ * of the frames are dropped, but the program still runs to the end.
+ */
+class FrameWriter {
+ private:
+    int fd_;
+    bool broken_;
+
+    void writeAll(const char *data, size_t size) {
+        while (size > 0 && !this->broken_) {
+            auto written = ::write(this->fd_, data, size);
+            if (written < 0) {
+                this->broken_ = errno != EINTR;
+                continue;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+ public:
+    explicit FrameWriter(int fd) : fd_(fd), broken_(false) { }
+
+    void write(const char *name, size_t number, const char *data = nullptr,
+               size_t size = 0) {
+        char header[32];
+        auto length = snprintf(header, sizeof(header), "%s %zu\n", name,
+                               number);
+        this->writeAll(header, length);
+        this->writeAll(data, size);
+    }
+};
+
+/**
+ * @brief Reader of frames sent by a client, buffered.
+ */
+class FrameReader {
+ private:
+    int fd_;
+    char buffer_[4096];
+    size_t begin_;
+    size_t end_;
+
+    bool fill() {
+        if (this->begin_ == this->end_) {
+            this->begin_ = this->end_ = 0;
+        }
+        while (true) {
+            auto count = ::read(this->fd_, this->buffer_ + this->end_,
+                                sizeof(this->buffer_) - this->end_);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            this->end_ += count;
+            return true;
+        }
+    }
+
+ public:
+    explicit FrameReader(int fd) : fd_(fd), begin_(0), end_(0) { }
+
+    /**
+     * @brief Read a header line without the newline.
+     * @returns false at the end of the input or if the line is too long.
+     */
+    bool readLine(std::string *line) {
+        line->clear();
+        while (true) {
+            auto start = this->buffer_ + this->begin_;
+            auto eol = static_cast<char*>(
+                memchr(start, '\n', this->end_ - this->begin_));
+            if (eol != nullptr) {
+                line->append(start, eol);
+                this->begin_ = eol - this->buffer_ + 1;
+                return true;
+            }
+            line->append(start, this->buffer_ + this->end_);
+            this->begin_ = this->end_;
+            if (line->size() > sizeof(this->buffer_) || !this->fill()) {
+                return false;
+            }
+        }
+    }
+
+    bool read(char *data, size_t size) {
+        while (size > 0) {
+            if (this->begin_ == this->end_ && !this->fill()) {
+                return false;
+            }
+            auto count = std::min(size, this->end_ - this->begin_);
+            memcpy(data, this->buffer_ + this->begin_, count);
+            this->begin_ += count;
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Sends output and errors of a program to the client while it is
+ * alive, so standard streams are restored even if the program throws.
+ */
+class Redirection {
+ public:
+    explicit Redirection(FrameWriter *writer) {
+        Output::get().redirect(
+            [writer](const char *data, size_t size) {
+                writer->write("out", size, data, size);
+            },
+            [writer](const char *data, size_t size) {
+                writer->write("err", size, data, size);
+            });
+    }
+
+    ~Redirection() {
+        Output::get().redirect(Output::Sink(), Output::Sink());
+    }
+
+    Redirection(const Redirection&) = delete;
+    Redirection &operator=(const Redirection&) = delete;
+};
+
+/**
+ * @brief Send an error that ends the connection.
+ */
+static void reject(FrameWriter *writer, const std::string &message) {
+    std::string error = "ERROR:" + message + "\n";
+    writer->write("err", error.size(), error.data(), error.size());
+    writer->write("end", 2);
+}
+
+void Server::serve(int in, int out) {
+    FrameReader reader(in);
+    FrameWriter writer(out);
+    std::string line;
+    while (reader.readLine(&line)) {
+        size_t size;
+        int length = 0;
+        if (sscanf(line.c_str(), "run %zu%n", &size, &length) != 1 ||
+                static_cast<size_t>(length) != line.size()) {
+            reject(&writer, "Unknown request `" + line + "'");
+            return;
+        }
+        /* Data of the program isn't read, so the connection can't be used
+         * anymore.  */
+        if (size > kMaxProgramSize) {
+            reject(&writer, "Program of " + std::to_string(size) +
+                            " bytes is larger than " +
+                            std::to_string(kMaxProgramSize) + " bytes");
+            return;
+        }
+
+        std::string program(size + 2, '\0');
+        if (!reader.read(&program[0], size)) {
+            return;
+        }
+        bool ok = false;
+        {
+            Redirection redirection(&writer);
+            try {
+                ok = this->runner_(&program[0], size);
+            } catch (std::exception &e) {
+                Output::get().writeError(std::string("ERROR:") + e.what() +
+                                         "\n");
+            }
+        }
+        writer.write("end", ok ? 0 : 1);
+    }
+}
+
+void Server::serveStdin() {
+    this->serve(STDIN_FILENO, STDOUT_FILENO);
+}
+
+bool Server::serveSocket(const std::string &path) {
+    struct sockaddr_un address;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "ERROR:" << path << ": Path is too long" << std::endl;
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    /* Socket of a server that has been killed is left behind.  */
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+            bind(fd, reinterpret_cast<struct sockaddr*>(&address),
+                 sizeof(address)) != 0 ||
+            listen(fd, 16) != 0) {
+        std::cerr << "ERROR:" << path << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    /* Client that disconnects in the middle of a program shouldn't kill
+     * the server.  */
+    signal(SIGPIPE, SIG_IGN);
+    while (true) {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "ERROR:" << path << ": " << strerror(errno)
+                      << std::endl;
+            close(fd);
+            return false;
+        }
+        this->serve(client, client);
+        close(client);
+    }
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
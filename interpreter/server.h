@@ -0,0 +1,83 @@
+/* Server that runs programs sent by clients.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+
+/**
+ * @brief Long-lived interpreter, that runs programs sent by clients.
+ *
+ * The process, the thread pool and the pools of memory stay warm between
+ * programs, while each program is run in a new context, so programs can't
+ * see variables of each other.  Programs are run one at a time.
+ *
+ * Protocol is a sequence of frames, each one is a header line of a name and
+ * a decimal number, followed by the number of bytes of data, if any:
+ *
+ *   run <size>     Client sends a program of `size' bytes.
+ *   out <size>     Server sends output of the program as it is produced.
+ *   err <size>     Server sends error messages.
+ *   end <status>   Program is done, status is 0 if there were no errors.
+ *
+ * Invalid requests and programs larger than kMaxProgramSize are answered
+ * with an error and `end 2', and the connection is closed.
+ *
+ * A connection can run any number of programs one after another.
+ */
+class Server {
+ public:
+    /* Requests to run larger programs are rejected.  */
+    static const size_t kMaxProgramSize = 64 << 20;
+
+    /**
+     * @brief Function that runs a program in a new context.  Program is
+     * followed by two NUL characters, that are not counted in `size'.
+     * @returns false if there were errors.
+     */
+    typedef std::function<bool(char *program, size_t size)> Runner;
+
+ private:
+    Runner runner_;
+
+    /**
+     * @brief Serve requests read from `in' until it is closed.
+     */
+    void serve(int in, int out);
+
+ public:
+    explicit Server(const Runner &runner) : runner_(runner) { }
+
+    /**
+     * @brief Serve requests from standard input.
+     */
+    void serveStdin();
+
+    /**
+     * @brief Accept clients on a UNIX domain socket, forever.
+     * @returns false if the socket can't be created.
+     */
+    bool serveSocket(const std::string &path);
+};
+
+#endif  // SERVER_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,116 @@
+/* Memory for elements of vectors, that can be spilled to disk.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spill.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include "options.h"
+
+/* Bytes of arrays allocated on the heap.  */
+static std::atomic<size_t> heapBytes(0);
+
+/**
+ * @brief Throw an error about the spill file.
+ */
+static void spillError(const std::string &path) {
+    throw std::runtime_error("Can't create spill file " + path + ": " +
+                             strerror(errno));
+}
+
+/**
+ * @brief Map a new temporary file of given size into memory.
+ */
+static void *mapSpillFile(size_t bytes) {
+    auto dir = getenv("TMPDIR");
+    std::string path = (dir != nullptr && *dir != '\0') ? dir : "/tmp";
+    path += "/interpreter-spill-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        spillError(path);
+    }
+    /* File is deleted right away, it exists while it is mapped.  */
+    unlink(path.c_str());
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        spillError(path);
+    }
+    auto p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        spillError(path);
+    }
+    madvise(p, bytes, MADV_SEQUENTIAL);
+    return p;
+}
+
+void *Spill::allocate(size_t bytes, bool *spilled) {
+    auto budget = Options::get().memoryBudget;
+    if (budget != 0 && bytes >= kMinSize &&
+            heapBytes.load(std::memory_order_relaxed) + bytes > budget) {
+        *spilled = true;
+        return mapSpillFile(bytes);
+    }
+
+    auto p = malloc(bytes);
+    if (p == nullptr && bytes != 0) {
+        throw std::bad_alloc();
+    }
+    heapBytes.fetch_add(bytes, std::memory_order_relaxed);
+    *spilled = false;
+    return p;
+}
+
+void Spill::free(void *p, size_t bytes, bool spilled) {
+    if (spilled) {
+        /* Arrays loaded from files start after the header, not at the start
+         * of the mapping.  */
+        static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+        auto offset = reinterpret_cast<uintptr_t>(p) & (pageSize - 1);
+        munmap(static_cast<char*>(p) - offset, bytes + offset);
+    } else {
+        ::free(p);
+        heapBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+}
+
+void Spill::release(const void *p, size_t bytes) {
+    /* Spill files are mapped shared, so dropped pages, even partially
+     * processed ones at the ends of the range, are written to the file
+     * first.  Files loaded by VectorFile::load() are mapped privately, but
+     * their columns are never written, so dropped pages are read back from
+     * the file unchanged.  Start is rounded down and end is rounded down as
+     * well, so the page being written next isn't dropped.  */
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    auto begin = reinterpret_cast<uintptr_t>(p) & ~(pageSize - 1);
+    auto end = (reinterpret_cast<uintptr_t>(p) + bytes) & ~(pageSize - 1);
+    if (end > begin) {
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
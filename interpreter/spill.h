@@ -0,0 +1,69 @@
+/* Memory for elements of vectors, that can be spilled to disk.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPILL_H_
+#define SPILL_H_
+
+#include <stddef.h>
+
+/**
+ * @brief Allocator of arrays of vector elements.
+ *
+ * Arrays are allocated on the heap until arrays on the heap take more than
+ * the memory budget set in options.  After that large arrays are allocated in
+ * temporary files, that are mapped into memory and deleted right away, so
+ * they disappear when the process exits.  Kernel writes pages of such arrays
+ * to the file when memory is short, instead of failing, and reads them back
+ * on access.  Sequences stream over spilled arrays in blocks and release each
+ * block from memory once it is processed, so that a pass over a vector that
+ * doesn't fit in memory reads the file sequentially.
+ */
+class Spill {
+ public:
+    /* Arrays smaller than this always stay on the heap.  */
+    static const size_t kMinSize = 1 << 20;
+
+    /* Spilled arrays are processed and released in blocks of this size.  */
+    static const size_t kBlockSize = 4 << 20;
+
+    /**
+     * @brief Allocate memory for an array.  Memory of spilled arrays is
+     * filled with zeroes, memory on the heap is not initialized.
+     *
+     * @param spilled Set to true if array is allocated in a file.
+     * @throws std::runtime_error if the file can't be created.
+     */
+    static void *allocate(size_t bytes, bool *spilled);
+
+    /**
+     * @brief Free an array.  Spilled arrays are unmapped, that includes
+     * arrays mapped from files by VectorFile::load().
+     */
+    static void free(void *p, size_t bytes, bool spilled);
+
+    /**
+     * @brief Let the kernel drop whole pages of [p, p + bytes) of a spilled
+     * or loaded array from memory.  Contents are kept in the file and are
+     * read back when they are accessed again.  Loaded arrays are mapped
+     * privately, so they must not be written.
+     */
+    static void release(const void *p, size_t bytes);
+};
+
+#endif  // SPILL_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -22,6 +22,10 @@
 
 #include "context.h"
 #include "expression.h"
+#include "output.h"
+#include "profile.h"
+#include "vectorfile.h"
+#include "vm.h"
 
 /**
  * @brief Abstract class to represent program statements
@@ -30,6 +34,40 @@ class Statement {
  public:
     virtual ~Statement() { }
 
+    /**
+     * @brief Resolve identifiers used by statement to context slots.  Should
+     * be called right before the statement is executed.
+     */
+    virtual void resolve(Context *ctx) { }
+
+    /**
+     * @brief Slot of the variable set by the statement, -1 if it doesn't set
+     * one.  Valid after resolve().
+     */
+    virtual int getVariableSlot() const {
+        return -1;
+    }
+
+    /**
+     * @brief Optimize expressions of the statement.  Should be called after
+     * resolve(), when it is known which variables are scalars.
+     */
+    virtual void optimize() { }
+
+    /**
+     * @brief Register statement and its expressions in the profile.  Should
+     * be called after optimize().
+     *
+     * @param line Line of the statement.
+     * @returns Site to measure execution of the statement.
+     */
+    virtual Profile::Site *profile(int line) = 0;
+
+    /**
+     * @brief Print statement and its expression tree.
+     */
+    virtual void dump(std::ostream *out) const = 0;
+
     /**
      * @brief Execute statement.
      */
@@ -41,17 +79,41 @@ class Statement {
  */
 class OutStatement : public Statement {
  private:
-    const Expression *expr_;
+    Expression *expr_;
 
  public:
-    explicit OutStatement(const Expression *expr) : expr_(expr) { }
+    explicit OutStatement(Expression *expr) : expr_(expr) { }
 
     virtual ~OutStatement() {
         delete expr_;
     }
 
+    virtual void resolve(Context *ctx) {
+        this->expr_->resolve(*ctx);
+    }
+
+    virtual void optimize() {
+        this->expr_ = this->expr_->optimize();
+    }
+
+    virtual Profile::Site *profile(int line) {
+        auto site = Profile::get().addSite(line, -1, 0, "Out",
+                                           Profile::kProcessClock);
+        this->expr_ = this->expr_->profile(1, Profile::kThreadClock);
+        return site;
+    }
+
+    virtual void dump(std::ostream *out) const {
+        *out << "Out" << std::endl;
+        this->expr_->dump(out, 1);
+    }
+
     virtual void execute(Context *ctx) {
-        std::cout << this->expr_->evaluate(ctx)->asString();
+        auto value = evaluateExpression(this->expr_, ctx);
+        if (!value.isScalar()) {
+            Profile::countElements(value.getSize());
+        }
+        value.print(&Output::get());
     }
 };
 
@@ -62,26 +124,112 @@ class PrintStatement : public Statement {
  public:
     explicit PrintStatement(const std::string &s) : str_(s) { }
 
+    virtual Profile::Site *profile(int line) {
+        return Profile::get().addSite(line, -1, 0, "Print",
+                                      Profile::kProcessClock);
+    }
+
+    virtual void dump(std::ostream *out) const {
+        *out << "Print" << std::endl;
+    }
+
     virtual void execute(Context *ctx) {
-        std::cout << this->str_;
+        Output::get().write(this->str_);
+    }
+};
+
+/**
+ * @brief `save "file" expr', writes a sequence to a file for `load'.
+ */
+class SaveStatement : public Statement {
+ private:
+    const std::string path_;
+    Expression *expr_;
+
+ public:
+    SaveStatement(const std::string &path, Expression *expr)
+        : path_(path), expr_(expr) { }
+
+    virtual ~SaveStatement() {
+        delete this->expr_;
+    }
+
+    virtual void resolve(Context *ctx) {
+        this->expr_->resolve(*ctx);
+    }
+
+    virtual void optimize() {
+        this->expr_ = this->expr_->optimize();
+    }
+
+    virtual Profile::Site *profile(int line) {
+        auto site = Profile::get().addSite(line, -1, 0, "Save " + this->path_,
+                                           Profile::kProcessClock);
+        this->expr_ = this->expr_->profile(1, Profile::kThreadClock);
+        return site;
+    }
+
+    virtual void dump(std::ostream *out) const {
+        *out << "Save " << this->path_ << std::endl;
+        this->expr_->dump(out, 1);
+    }
+
+    virtual void execute(Context *ctx) {
+        auto value = evaluateExpression(this->expr_, ctx);
+        if (!value.isScalar()) {
+            Profile::countElements(value.getSize());
+        }
+        VectorFile::save(this->path_, value);
     }
 };
 
 class VarStatement : public Statement {
  private:
     const std::string name_;
-    const Expression *expr_;
+    Expression *expr_;
+    int slot_;
 
  public:
-    VarStatement(const std::string &name, const Expression *expr) :
-            name_(name), expr_(expr) { }
+    VarStatement(const std::string &name, Expression *expr) :
+            name_(name), expr_(expr), slot_(-1) { }
 
     virtual ~VarStatement() {
         delete this->expr_;
     }
 
+    /* Expression is resolved before the variable is declared, so it can't
+     * refer to the variable, unless it was defined by an earlier statement.  */
+    virtual void resolve(Context *ctx) {
+        this->expr_->resolve(*ctx);
+        this->slot_ = ctx->declareVariable(this->name_);
+    }
+
+    virtual int getVariableSlot() const {
+        return this->slot_;
+    }
+
+    virtual void optimize() {
+        this->expr_ = this->expr_->optimize();
+    }
+
+    virtual Profile::Site *profile(int line) {
+        auto site = Profile::get().addSite(line, -1, 0, "Var " + this->name_,
+                                           Profile::kProcessClock);
+        this->expr_ = this->expr_->profile(1, Profile::kThreadClock);
+        return site;
+    }
+
+    virtual void dump(std::ostream *out) const {
+        *out << "Var " << this->name_ << std::endl;
+        this->expr_->dump(out, 1);
+    }
+
     virtual void execute(Context *ctx) {
-        ctx->setVariable(this->name_, this->expr_->evaluate(ctx));
+        auto value = evaluateExpression(this->expr_, ctx);
+        if (!value.isScalar()) {
+            Profile::countElements(value.getSize());
+        }
+        ctx->setVariable(this->slot_, value.promote());
     }
 };
 
@@ -0,0 +1,192 @@
+/* Work-stealing thread pool shared by parallel operators.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadpool.h"
+
+#include <exception>
+
+#include "options.h"
+
+/**
+ * @brief Tasks created by a single parallelFor() call.
+ */
+struct ThreadPool::Group {
+    std::atomic<int> remaining;
+    std::vector<std::exception_ptr> errors;
+
+    explicit Group(int count) : remaining(count), errors(count) { }
+};
+
+/* Index of the worker deque owned by current thread, -1 for threads that
+ * are not part of the pool.  */
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(int threadsCount)
+    : nextWorker_(0), queued_(0), stop_(false) {
+    /* Thread that calls parallelFor() does work as well, so one thread less
+     * is needed.  */
+    for (int i = 0; i < threadsCount - 1; i++) {
+        this->workers_.emplace_back(new Worker());
+    }
+    for (int i = 0; i < threadsCount - 1; i++) {
+        this->threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->sleepMutex_);
+        this->stop_ = true;
+    }
+    this->wakeup_.notify_all();
+    for (auto &&thread : this->threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::push(const Task &task) {
+    int index = currentWorker;
+    if (index < 0) {
+        index = this->nextWorker_++ % this->workers_.size();
+    }
+
+    auto &worker = *this->workers_[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->sleepMutex_);
+        this->queued_++;
+    }
+    this->wakeup_.notify_all();
+}
+
+bool ThreadPool::popTask(Task *task) {
+    /* Own tasks are taken LIFO, they are most likely to be hot in cache.  */
+    if (currentWorker >= 0) {
+        auto &worker = *this->workers_[currentWorker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            *task = worker.tasks.back();
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+
+    /* Other tasks are stolen FIFO, those are the largest remaining pieces of
+     * work.  */
+    auto count = this->workers_.size();
+    auto start = currentWorker >= 0 ? currentWorker + 1 : 0;
+    for (size_t i = 0; i < count; i++) {
+        auto &worker = *this->workers_[(start + i) % count];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            *task = worker.tasks.front();
+            worker.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runPending() {
+    if (this->queued_ == 0) {
+        return false;
+    }
+
+    Task task;
+    if (!this->popTask(&task)) {
+        return false;
+    }
+    this->queued_--;
+    this->run(task);
+    return true;
+}
+
+void ThreadPool::run(const Task &task) {
+    auto group = task.group;
+    try {
+        (*task.func)(task.index);
+    } catch (...) {
+        group->errors[task.index] = std::current_exception();
+    }
+
+    /* Group is owned by the waiting thread and can be destroyed as soon as
+     * the counter reaches zero, so it must not be accessed afterwards.  */
+    if (--group->remaining == 0) {
+        { std::lock_guard<std::mutex> lock(this->sleepMutex_); }
+        this->wakeup_.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(int index) {
+    currentWorker = index;
+    while (true) {
+        if (this->runPending()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->sleepMutex_);
+        this->wakeup_.wait(lock, [this]() {
+            return this->stop_ || this->queued_ > 0;
+        });
+        if (this->stop_ && this->queued_ == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(int count,
+                             const std::function<void(int)> &func) {
+    if (count == 1 || this->workers_.empty()) {
+        for (int i = 0; i < count; i++) {
+            func(i);
+        }
+        return;
+    }
+
+    Group group(count);
+    for (int i = 1; i < count; i++) {
+        this->push(Task{&func, i, &group});
+    }
+    this->run(Task{&func, 0, &group});
+
+    while (group.remaining > 0) {
+        if (this->runPending()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->sleepMutex_);
+        this->wakeup_.wait(lock, [this, &group]() {
+            return group.remaining == 0 || this->queued_ > 0;
+        });
+    }
+
+    for (auto &&error : group.errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+ThreadPool &ThreadPool::get() {
+    static ThreadPool pool(Options::get().getThreadsCount());
+    return pool;
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
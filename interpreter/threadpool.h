@@ -0,0 +1,109 @@
+/* Work-stealing thread pool shared by parallel operators.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable> // NOLINT
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex> // NOLINT
+#include <thread> // NOLINT
+#include <vector>
+
+/**
+ * @brief Process-wide pool of worker threads.
+ *
+ * Each worker owns a deque of tasks: it takes tasks from the back of its own
+ * deque and steals from the front of deques of other workers when its own is
+ * empty.  Thread waiting for its tasks to complete doesn't block, but runs
+ * pending tasks in the meanwhile, so parallel operations can be nested
+ * without exhausting the pool.
+ */
+class ThreadPool {
+ private:
+    struct Group;
+
+    struct Task {
+        const std::function<void(int)> *func;
+        int index;
+        Group *group;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector< std::unique_ptr<Worker> > workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<unsigned> nextWorker_;
+
+    /* Sleeping threads wait on this condition for new tasks to be queued or
+     * for a group to complete.  */
+    std::mutex sleepMutex_;
+    std::condition_variable wakeup_;
+    std::atomic<int> queued_;
+    bool stop_;
+
+    void push(const Task &task);
+
+    bool popTask(Task *task);
+
+    bool runPending();
+
+    void run(const Task &task);
+
+    void workerLoop(int index);
+
+    explicit ThreadPool(int threadsCount);
+
+ public:
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Number of threads that execute tasks, including the caller.
+     */
+    int getThreadsCount() const {
+        return this->threads_.size() + 1;
+    }
+
+    /**
+     * @brief Call func(i) for every i in [0, count) and wait until all calls
+     * are finished.
+     *
+     * Calls are distributed over the pool, the calling thread participates as
+     * well.  If any call throws, then exception of a call with the lowest
+     * index is rethrown after all calls are finished.
+     */
+    void parallelFor(int count, const std::function<void(int)> &func);
+
+    /**
+     * @brief Get the pool, creating it on first use with the number of
+     * threads set in options.
+     */
+    static ThreadPool &get();
+};
+
+#endif  // THREADPOOL_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
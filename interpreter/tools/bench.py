@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+#
+# End-to-end benchmarks of the interpreter
+# Copyright (C) 2017 Anton Kolesov
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Run a fixed set of programs with the interpreter and measure them.
+
+Each workload is run with 1 to N threads of the pool.  For every number of
+threads the fastest of several runs is taken and reported as wall time,
+throughput in elements per second and peak resident memory.  Results are
+written as JSON, and can be compared with results saved earlier:
+
+    $ tools/bench.py --output=baseline.json
+    ... change the interpreter ...
+    $ tools/bench.py --baseline=baseline.json
+
+Comparison reports every workload that became slower than the baseline by
+more than the tolerance, and exits with status 1 if there is any.
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def many_statements(count):
+    lines = []
+    for i in range(count):
+        lines.append('var x%d = %d * 2 + 1' % (i % 100, i))
+        if i % 1000 == 999:
+            lines.append('out x%d' % (i % 100))
+    return '\n'.join(lines) + '\n'
+
+
+# Name, number of elements processed, program.
+WORKLOADS = [
+    ('map_large', 20000000,
+     'var m = map({1, 20000000}, i -> i * 2 + 1)\n'),
+    ('reduce_large', 30000000,
+     'out reduce({1, 30000000}, 0.0, a b -> a + b * b)\n'),
+    ('map_reduce', 20000000,
+     'out reduce(map({1, 20000000}, i -> i / 3.0), 0.0, a b -> a + b)\n'),
+    ('pi_series', 20000000,
+     'var n = 20000000\n'
+     'var sequence = map({0, n}, i -> (-1.0)^i / (2 * i + 1))\n'
+     'var pi = 4 * reduce(sequence, 0, x y -> x + y)\n'
+     'out pi\n'),
+    ('many_statements', 100000, many_statements(100000)),
+    ('out_large', 10000000,
+     'out {1, 5000000}\n'
+     'out map({1, 5000000}, i -> i / 7.0)\n'),
+]
+
+
+def default_threads():
+    """Powers of two up to the number of CPUs, and the number itself."""
+    cpus = os.cpu_count() or 1
+    threads = []
+    n = 1
+    while n < cpus:
+        threads.append(n)
+        n *= 2
+    threads.append(cpus)
+    return threads
+
+
+def run_once(app, flags, program, threads):
+    """Run the program, return wall time and peak RSS of the process."""
+    args = [app, '--threads=%d' % threads] + flags + [program]
+    with open(os.devnull, 'wb') as devnull:
+        start = time.perf_counter()
+        process = subprocess.Popen(args, stdout=devnull,
+                                   stderr=subprocess.PIPE)
+        # wait4() gives resource usage of this process only, unlike
+        # getrusage(RUSAGE_CHILDREN), that is maximum over all children.
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        errors = process.stderr.read().decode(errors='replace')
+        process.stderr.close()
+        # Process is already reaped, Popen must not wait for it again.
+        process.returncode = status
+    if status != 0:
+        raise RuntimeError('%s failed:\n%s' % (' '.join(args), errors))
+    # ru_maxrss is in kilobytes on Linux.
+    return wall, usage.ru_maxrss * 1024
+
+
+def run_workload(app, flags, directory, workload, threads_list, repeat):
+    name, elements, text = workload
+    program = os.path.join(directory, name + '.in')
+    with open(program, 'w') as f:
+        f.write(text)
+
+    runs = []
+    for threads in threads_list:
+        walls = []
+        rss = 0
+        for _ in range(repeat):
+            wall, peak = run_once(app, flags, program, threads)
+            walls.append(wall)
+            rss = max(rss, peak)
+        wall = min(walls)
+        runs.append({
+            'threads': threads,
+            'wall_seconds': wall,
+            'elements_per_second': elements / wall,
+            'peak_rss_bytes': rss,
+            'speedup': runs[0]['wall_seconds'] / wall if runs else 1.0,
+        })
+        print('%-16s threads=%-3d %9.3f s %12.4g elements/s %8.1f MiB '
+              'x%.2f' % (name, threads, wall, elements / wall,
+                         rss / 2.0**20, runs[-1]['speedup']))
+        sys.stdout.flush()
+    return {'name': name, 'elements': elements, 'runs': runs}
+
+
+def compare(results, baseline, tolerance):
+    """Print regressions against the baseline, return their number."""
+    saved = {}
+    for workload in baseline['workloads']:
+        for run in workload['runs']:
+            saved[(workload['name'], run['threads'])] = run
+
+    regressions = 0
+    for workload in results['workloads']:
+        for run in workload['runs']:
+            key = (workload['name'], run['threads'])
+            if key not in saved:
+                continue
+            old = saved[key]
+            ratio = run['wall_seconds'] / old['wall_seconds']
+            memory = run['peak_rss_bytes'] / max(old['peak_rss_bytes'], 1)
+            if ratio > 1 + tolerance or memory > 1 + tolerance:
+                regressions += 1
+                print('REGRESSION: %s threads=%d: time %.3f s -> %.3f s '
+                      '(%+.1f%%), memory %.1f MiB -> %.1f MiB (%+.1f%%)' % (
+                          key[0], key[1], old['wall_seconds'],
+                          run['wall_seconds'], (ratio - 1) * 100,
+                          old['peak_rss_bytes'] / 2.0**20,
+                          run['peak_rss_bytes'] / 2.0**20,
+                          (memory - 1) * 100))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument('--app', default='./interpreter.elf',
+                        help='interpreter to run (default: %(default)s)')
+    parser.add_argument('--flags', default='',
+                        help='extra options of the interpreter')
+    parser.add_argument('--threads', default=None,
+                        help='comma separated numbers of threads '
+                        '(default: 1, 2, 4... up to the number of CPUs)')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='runs of each workload, the fastest is taken '
+                        '(default: %(default)s)')
+    parser.add_argument('--only', default=None,
+                        help='comma separated names of workloads to run')
+    parser.add_argument('--output', default='bench.json',
+                        help='file to write results to '
+                        '(default: %(default)s)')
+    parser.add_argument('--baseline', default=None,
+                        help='results to compare with')
+    parser.add_argument('--tolerance', type=float, default=0.10,
+                        help='slowdown that is not yet a regression '
+                        '(default: %(default)s)')
+    args = parser.parse_args()
+
+    if args.threads:
+        threads_list = [int(n) for n in args.threads.split(',')]
+    else:
+        threads_list = default_threads()
+    workloads = WORKLOADS
+    if args.only:
+        names = args.only.split(',')
+        workloads = [w for w in WORKLOADS if w[0] in names]
+
+    # Baseline is read first, so it can be overwritten with new results.
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    results = {
+        'app': args.app,
+        'flags': args.flags,
+        'machine': platform.machine(),
+        'cpus': os.cpu_count(),
+        'repeat': args.repeat,
+        'workloads': [],
+    }
+    flags = args.flags.split()
+    with tempfile.TemporaryDirectory(prefix='bench') as directory:
+        for workload in workloads:
+            results['workloads'].append(run_workload(
+                args.app, flags, directory, workload, threads_list,
+                args.repeat))
+
+    with open(args.output, 'w') as f:
+        json.dump(results, f, indent=2)
+        f.write('\n')
+
+    if baseline is not None:
+        regressions = compare(results, baseline, args.tolerance)
+        if regressions:
+            print('%d regression(s) against %s' % (regressions,
+                                                  args.baseline))
+            return 1
+        print('No regressions against %s' % args.baseline)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -15,175 +15,484 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+#include <stdint.h>
+
+#include <algorithm>
 #include <cmath>
 
+#include "kernels.h"
 #include "value.h"
 
-const ValuePtr Value::kNone = std::make_shared<const NoneValue>();
+const Value Value::kNone;
+
+/**
+ * Number of range elements generated at once by
+ * IntegerRangeValue::forEachChunk.  */
+static const int kRangeChunkSize = 1024;
+
+/**
+ * Number of elements processed at once by element-wise operations.  */
+static const int kBlockSize = 1024;
+
+static int powInteger(int base, int exponent) {
+    if (exponent >= 0) {
+        /* Exponentiation by squaring.  Unsigned arithmetic is used so that
+         * overflow wraps around, just like for multiplication.  */
+        uint32_t b = base, result = 1;
+        for (uint32_t e = exponent; e != 0; e >>= 1) {
+            if (e & 1) {
+                result *= b;
+            }
+            b *= b;
+        }
+        return static_cast<int>(result);
+    }
 
-ValuePtr Value::add(const ValuePtr &r) const {
-    if (this->isNone() || r->isNone()) {
-        return kNone;
+    /* Negative exponent gives a fraction, which is truncated to int.  */
+    return static_cast<int>(std::pow(base, exponent));
+}
+
+/**
+ * @brief Get elements [begin, begin + size) of an operand of element-wise
+ * operation as a contiguous array of type T.
+ *
+ * Elements of vectors are returned without copying when possible, otherwise
+ * they are copied or converted into the buffer.  Scalars are broadcast: buffer is
+ * filled with the value once, because it doesn't change between blocks.
+ */
+template <typename T>
+static const T *getOperandBlock(const Value &operand, int begin, int size,
+                                T *buffer, const T *(*chunkData)(const Chunk&),
+                                bool *bufferFilled) {
+    if (operand.isScalar()) {
+        if (!*bufferFilled) {
+            auto v = operand.isScalarFloat() ? operand.asFloat()
+                                             : operand.asInteger();
+            std::fill(buffer, buffer + kBlockSize, static_cast<T>(v));
+            *bufferFilled = true;
+        }
+        return buffer;
     }
 
-    checkScalarArgs(r);
+    /* Chunks of a range are generated into a temporary buffer, only chunks
+     * of a vector can be used after forEachChunk() returns.  */
+    auto isVector =
+        dynamic_cast<const VectorValue*>(operand.getSequence()) != nullptr;
+    const T *result = nullptr;
+    auto offset = 0;
+    operand.forEachChunk(begin, begin + size, [&](const Chunk &chunk) {
+        auto data = chunkData(chunk);
+        if (isVector && data != nullptr && chunk.size == size) {
+            result = data;
+            return;
+        }
+        for (int i = 0; i < chunk.size; i++) {
+            buffer[offset + i] = chunk.floats != nullptr
+                                 ? static_cast<T>(chunk.floats[i])
+                                 : static_cast<T>(chunk.integers[i]);
+        }
+        offset += chunk.size;
+    });
+    return result != nullptr ? result : buffer;
+}
 
-    if (!this->isScalarFloat() && !r->isScalarFloat()) {
-        auto result = this->asInteger() + r->asInteger();
-        return std::make_shared<const ScalarValue>(result);
-    } else {
-        auto result = this->asFloat() + r->asFloat();
-        return std::make_shared<const ScalarValue>(result);
+static const int *getChunkIntegers(const Chunk &chunk) {
+    return chunk.integers;
+}
+
+static const double *getChunkFloats(const Chunk &chunk) {
+    return chunk.floats;
+}
+
+const std::string Value::asString() const {
+    switch (this->type_) {
+        case kInteger:
+            return std::to_string(this->intValue_);
+        case kFloat:
+            return std::to_string(this->floatValue_);
+        case kSequence:
+            return this->sequence_->asString();
+        default: {
+            static const std::string s = "(none)";
+            return s;
+        }
     }
 }
 
-ValuePtr Value::sub(const ValuePtr &r) const {
-    if (this->isNone() || r->isNone()) {
-        return kNone;
+void Value::print(Output *out) const {
+    switch (this->type_) {
+        case kInteger:
+            out->writeInteger(this->intValue_);
+            break;
+        case kFloat:
+            out->writeFloat(this->floatValue_);
+            break;
+        case kSequence: {
+            bool first = true;
+            out->write("{", 1);
+            this->sequence_->forEachChunk(0, this->sequence_->getSize(),
+                                          [out, &first](const Chunk &c) {
+                for (int i = 0; i < c.size; i++) {
+                    if (!first) {
+                        out->write(", ", 2);
+                    }
+                    first = false;
+                    if (c.integers != nullptr) {
+                        out->writeInteger(c.integers[i]);
+                    } else {
+                        out->writeFloat(c.floats[i]);
+                    }
+                }
+            });
+            out->write("}", 1);
+            break;
+        }
+        default:
+            out->write(this->asString());
+            break;
     }
+}
 
-    checkScalarArgs(r);
+Value Value::promote() const {
+    if (this->type_ != kSequence || !Arena::inArena(this->sequence_)) {
+        return *this;
+    }
+    Arena::Use heap(Arena::kTemporaries, nullptr);
+    return Value(this->sequence_->clone());
+}
 
-    if (!this->isScalarFloat() && !r->isScalarFloat()) {
-        auto result = this->asInteger() - r->asInteger();
-        return std::make_shared<const ScalarValue>(result);
+int Value::sequenceAsInteger() const {
+    if (this->type_ == kSequence) {
+        return this->sequence_->asInteger();
     } else {
-        auto result = this->asFloat() - r->asFloat();
-        return std::make_shared<const ScalarValue>(result);
+        return 0xdeadbeef;
     }
 }
 
-ValuePtr Value::mul(const ValuePtr &r) const {
-    if (this->isNone() || r->isNone()) {
-        return kNone;
+size_t Value::getMemoryUsage() const {
+    if (this->type_ == kSequence) {
+        return this->sequence_->getMemoryUsage();
+    } else {
+        return 0;
     }
+}
 
-    checkScalarArgs(r);
+int Value::getSize() const {
+    if (this->type_ == kSequence) {
+        return this->sequence_->getSize();
+    } else {
+        return 1;
+    }
+}
+
+void Value::forEachChunk(int begin, int end,
+                         const ChunkCallback &callback) const {
+    if (this->type_ == kSequence) {
+        this->sequence_->forEachChunk(begin, end, callback);
+    }
+}
+
+/**
+ * @brief Check that integer division won't trap: divisor must not be zero,
+ * and INT_MIN can't be divided by -1.
+ */
+static void checkDivisor(int a, int b) {
+    if (b == 0) {
+        throw std::invalid_argument("Integer division by zero.");
+    }
+    if (b == -1 && a == INT_MIN) {
+        throw std::invalid_argument("Integer overflow in division.");
+    }
+}
 
-    if (!this->isScalarFloat() && !r->isScalarFloat()) {
-        auto result = this->asInteger() * r->asInteger();
-        return std::make_shared<const ScalarValue>(result);
+static void checkDivisors(const int *a, const int *b, int n) {
+    for (int i = 0; i < n; i++) {
+        checkDivisor(a[i], b[i]);
+    }
+}
+
+/**
+ * @brief Release the last finished block of a spilled result from memory.
+ * @param written Number of elements written so far.
+ */
+static void releaseWritten(const Column &column, int written) {
+    int blockSize = Spill::kBlockSize / sizeof(double);
+    if (column.isSpilled() && written % blockSize == 0) {
+        column.release(written - blockSize, written);
+    }
+}
+
+Value Value::applyElementWise(const Value &r, Operation op) const {
+    auto size = this->isScalar() ? r.getSize() : this->getSize();
+    if (!this->isScalar() && !r.isScalar() && r.getSize() != size) {
+        auto msg = "Cannot perform arithmetic operation on vectors of "
+                   "different sizes.";
+        throw std::invalid_argument(msg);
+    }
+
+    auto isFloat = [](const Value &v) {
+        return v.isScalar() ? v.isScalarFloat() : v.getSequence()->isFloat();
+    };
+    std::unique_ptr<Column> result(new Column(
+        isFloat(*this) || isFloat(r) ? Column::kFloat : Column::kInteger));
+    result->resize(size);
+
+    auto &kernels = Kernels::get();
+    bool lFilled = false, rFilled = false;
+    if (result->isFloat()) {
+        double lBuffer[kBlockSize], rBuffer[kBlockSize];
+        Kernels::FloatKernel kernel = nullptr;
+        switch (op) {
+            case kAddition:
+                kernel = kernels.addFloats;
+                break;
+            case kSubtraction:
+                kernel = kernels.subFloats;
+                break;
+            case kMultiplication:
+                kernel = kernels.mulFloats;
+                break;
+            case kDivision:
+                kernel = kernels.divFloats;
+                break;
+            case kPower:
+                break;
+        }
+
+        for (int begin = 0; begin < size; begin += kBlockSize) {
+            auto n = std::min(kBlockSize, size - begin);
+            auto a = getOperandBlock(*this, begin, n, lBuffer,
+                                     getChunkFloats, &lFilled);
+            auto b = getOperandBlock(r, begin, n, rBuffer,
+                                     getChunkFloats, &rFilled);
+            auto out = result->getFloats() + begin;
+            if (kernel != nullptr) {
+                kernel(a, b, out, n);
+            } else {
+                for (int i = 0; i < n; i++) {
+                    out[i] = std::pow(a[i], b[i]);
+                }
+            }
+            releaseWritten(*result, begin + n);
+        }
     } else {
-        auto result = this->asFloat() * r->asFloat();
-        return std::make_shared<const ScalarValue>(result);
+        int lBuffer[kBlockSize], rBuffer[kBlockSize];
+        Kernels::IntegerKernel kernel = nullptr;
+        switch (op) {
+            case kAddition:
+                kernel = kernels.addIntegers;
+                break;
+            case kSubtraction:
+                kernel = kernels.subIntegers;
+                break;
+            case kMultiplication:
+                kernel = kernels.mulIntegers;
+                break;
+            case kDivision:
+                break;
+            case kPower:
+                break;
+        }
+
+        for (int begin = 0; begin < size; begin += kBlockSize) {
+            auto n = std::min(kBlockSize, size - begin);
+            auto a = getOperandBlock(*this, begin, n, lBuffer,
+                                     getChunkIntegers, &lFilled);
+            auto b = getOperandBlock(r, begin, n, rBuffer,
+                                     getChunkIntegers, &rFilled);
+            auto out = result->getIntegers() + begin;
+            if (kernel != nullptr) {
+                kernel(a, b, out, n);
+            } else if (op == kDivision) {
+                checkDivisors(a, b, n);
+                for (int i = 0; i < n; i++) {
+                    out[i] = a[i] / b[i];
+                }
+            } else {
+                for (int i = 0; i < n; i++) {
+                    out[i] = powInteger(a[i], b[i]);
+                }
+            }
+            releaseWritten(*result, begin + n);
+        }
     }
+
+    return Value(new VectorValue(result.release()));
 }
 
-ValuePtr Value::div(const ValuePtr &r) const {
-    if (this->isNone() || r->isNone()) {
+Value Value::add(const Value &r) const {
+    if (this->isNone() || r.isNone()) {
         return kNone;
     }
 
-    checkScalarArgs(r);
+    if (!this->isScalar() || !r.isScalar()) {
+        return this->applyElementWise(r, kAddition);
+    }
 
-    if (!this->isScalarFloat() && !r->isScalarFloat()) {
-        auto result = this->asInteger() / r->asInteger();
-        return std::make_shared<const ScalarValue>(result);
+    if (!this->isScalarFloat() && !r.isScalarFloat()) {
+        return Value(this->asInteger() + r.asInteger());
     } else {
-        auto result = this->asFloat() / r->asFloat();
-        return std::make_shared<const ScalarValue>(result);
+        return Value(this->asFloat() + r.asFloat());
     }
 }
 
-ValuePtr Value::pow(const ValuePtr &r) const {
-    if (this->isNone() || r->isNone()) {
+Value Value::sub(const Value &r) const {
+    if (this->isNone() || r.isNone()) {
         return kNone;
     }
 
-    checkScalarArgs(r);
+    if (!this->isScalar() || !r.isScalar()) {
+        return this->applyElementWise(r, kSubtraction);
+    }
 
-    if (!this->isScalarFloat() && !r->isScalarFloat()) {
-        /* std::pow always returns floating point type, but if both input
-         * values were integer, then result should convert into int nicely,
-         * unless, of course, it too big.  */
-        auto v = std::pow(this->asInteger(), r->asInteger());
-        return std::make_shared<const ScalarValue>(static_cast<int>(v));
+    if (!this->isScalarFloat() && !r.isScalarFloat()) {
+        return Value(this->asInteger() - r.asInteger());
     } else {
-        auto result = std::pow(this->asFloat(), r->asFloat());
-        return std::make_shared<const ScalarValue>(result);
+        return Value(this->asFloat() - r.asFloat());
     }
 }
 
-ValuePtr VectorValue::asScalar() const {
-    return (*this->vec_)[this->begin_];
+Value Value::mul(const Value &r) const {
+    if (this->isNone() || r.isNone()) {
+        return kNone;
+    }
+
+    if (!this->isScalar() || !r.isScalar()) {
+        return this->applyElementWise(r, kMultiplication);
+    }
+
+    if (!this->isScalarFloat() && !r.isScalarFloat()) {
+        return Value(this->asInteger() * r.asInteger());
+    } else {
+        return Value(this->asFloat() * r.asFloat());
+    }
 }
 
-const std::string VectorValue::asString() const {
-    std::stringstream s;
-    s << "{";
+Value Value::div(const Value &r) const {
+    if (this->isNone() || r.isNone()) {
+        return kNone;
+    }
 
-    s << (*this->vec_)[this->begin_]->asString();
-    for (int i = this->begin_ + 1; i < this->end_; i++) {
-        s << ", " << (*this->vec_)[i]->asString();
+    if (!this->isScalar() || !r.isScalar()) {
+        return this->applyElementWise(r, kDivision);
     }
 
-    s << "}";
-    return s.str();
+    if (!this->isScalarFloat() && !r.isScalarFloat()) {
+        checkDivisor(this->asInteger(), r.asInteger());
+        return Value(this->asInteger() / r.asInteger());
+    } else {
+        return Value(this->asFloat() / r.asFloat());
+    }
 }
 
-ValuePtr VectorValue::next() const {
-    if (this->begin_ + 1 == this->end_) {
-        return Value::kNone;
+Value Value::pow(const Value &r) const {
+    if (this->isNone() || r.isNone()) {
+        return kNone;
+    }
+
+    if (!this->isScalar() || !r.isScalar()) {
+        return this->applyElementWise(r, kPower);
+    }
+
+    if (!this->isScalarFloat() && !r.isScalarFloat()) {
+        return Value(powInteger(this->asInteger(), r.asInteger()));
     } else {
-        return std::make_shared<const VectorValue>(*this,
-                                                   this->begin_ + 1,
-                                                   this->end_);
+        return Value(std::pow(this->asFloat(), r.asFloat()));
     }
 }
 
-const std::string IntegerRangeValue::asString() const {
+const std::string VectorValue::asString() const {
     std::stringstream s;
     s << "{";
 
-    s << this->asInteger();
-    for (auto v = this->next(); !v->isNone(); v = v->next()) {
-        s << ", " << v->asInteger();
+    s << this->column_->getString(this->begin_);
+    for (int i = this->begin_ + 1; i < this->end_; i++) {
+        s << ", " << this->column_->getString(i);
     }
 
     s << "}";
     return s.str();
 }
 
-ValuePtr IntegerRangeValue::asScalar() const {
-    return std::make_shared<const ScalarValue>(this->asInteger());
-}
-
-ValuePtr IntegerRangeValue::next() const {
-    if (this->current_ == this->end_) {
-        return Value::kNone;
+Value VectorValue::getItem(int index) const {
+    auto i = this->begin_ + index;
+    if (this->column_->isFloat()) {
+        return Value(this->column_->getFloat(i));
     } else {
-        return std::make_shared<const IntegerRangeValue>(this->current_ + 1,
-                                                         this->end_);
+        return Value(this->column_->getInteger(i));
     }
 }
 
-const std::string ScalarValue::asString() const {
-    if (this->type_ == kInteger) {
-        return std::to_string(this->intValue_);
-    } else {
-        return std::to_string(this->floatValue_);
+void VectorValue::forEachChunk(int begin, int end,
+                               const ChunkCallback &callback) const {
+    if (begin >= end) {
+        return;
+    }
+
+    auto &column = *this->column_;
+    auto emit = [&](int first, int last) {
+        Chunk chunk = { nullptr, nullptr, last - first };
+        if (column.isFloat()) {
+            chunk.floats = column.getFloats() + this->begin_ + first;
+        } else {
+            chunk.integers = column.getIntegers() + this->begin_ + first;
+        }
+        callback(chunk);
+    };
+
+    if (!column.isSpilled()) {
+        emit(begin, end);
+        return;
+    }
+
+    /* Blocks of a spilled column are released once they are processed, so
+     * the whole column is never in memory at once.  Callers may still use
+     * the last chunk after the callback returns, so a block is released
+     * only when a chunk after it is emitted.  Chunks read one after another
+     * cross each block boundary once, so each block is released once.  */
+    int blockSize = Spill::kBlockSize / sizeof(double);
+    for (int i = begin; i < end; i += blockSize) {
+        auto blockEnd = std::min(end, i + blockSize);
+        auto first = this->begin_ + i;
+        auto boundary = first - first % blockSize;
+        if (boundary > first - (blockEnd - i) && boundary >= blockSize) {
+            column.release(boundary - blockSize, boundary);
+        }
+        emit(i, blockEnd);
     }
 }
 
-int ScalarValue::asInteger() const {
-    switch (this->type_) {
-        case kInteger:
-          return this->intValue_;
-        case kFloat:
-          return static_cast<int>(this->floatValue_);
-        default:
-          return 0;
+const std::string IntegerRangeValue::asString() const {
+    if (this->getSize() == 0) {
+        return "{}";
     }
+
+    std::stringstream s;
+    s << "{";
+
+    s << this->asInteger();
+    this->forEachChunk(1, this->getSize(), [&s](const Chunk &chunk) {
+        for (int i = 0; i < chunk.size; i++) {
+            s << ", " << chunk.integers[i];
+        }
+    });
+
+    s << "}";
+    return s.str();
 }
 
-double ScalarValue::asFloat() const {
-    switch (this->type_) {
-        case kInteger:
-          return static_cast<double>(this->intValue_);
-        case kFloat:
-          return this->floatValue_;
-        default:
-          return 0.0;
+void IntegerRangeValue::forEachChunk(int begin, int end,
+                                     const ChunkCallback &callback) const {
+    int buffer[kRangeChunkSize];
+    Chunk chunk = { buffer, nullptr, 0 };
+    for (int i = begin; i < end; i += kRangeChunkSize) {
+        chunk.size = std::min(kRangeChunkSize, end - i);
+        auto first = this->current_ + i;
+        for (int j = 0; j < chunk.size; j++) {
+            buffer[j] = first + j;
+        }
+        callback(chunk);
     }
 }
 
@@ -1,4 +1,4 @@
-/* Representation of value in program - could be integer or float.
+/* Representation of value in program - could be integer, float or sequence.
  * Copyright (C) 2017 Anton Kolesov
  *
  * This program is free software: you can redistribute it and/or modify
@@ -18,6 +18,9 @@
 #ifndef VALUE_H_
 #define VALUE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <future> // NOLINT
 #include <memory>
 #include <mutex> // NOLINT
@@ -26,148 +29,385 @@
 #include <string>
 #include <vector>
 
+#include "arena.h"
+#include "column.h"
+#include "memstats.h"
+#include "output.h"
+
+class Sequence;
 class Value;
-typedef std::shared_ptr<const Value> ValuePtr;
 
-/* Creating a hierarchy of IntegerValue and FloatValue might be closer to
+/**
+ * @brief A run of consecutive elements of a sequence, stored unboxed.
+ *
+ * Exactly one of `integers' and `floats' is not null.  Pointers are valid only
+ * during the callback that received the chunk.
+ */
+struct Chunk {
+    const int *integers;
+    const double *floats;
+    int size;
+
+    /**
+     * @brief Get element of a chunk as a scalar value.
+     */
+    Value getItem(int index) const;
+};
+
+typedef std::function<void(const Chunk &)> ChunkCallback;
+
+/**
+ * @brief Value in a program: integer, float or a sequence.
+ *
+ * Values are passed around by value.  Scalars are stored right in the object,
+ * so arithmetic on them never touches the heap.  Only sequences are allocated
+ * on the heap, and Value holds a counted reference to them.
+ *
+ * Creating a hierarchy of IntegerValue and FloatValue might be closer to
  * canonical object oriented design, but I'm not sure this would really make
- * code any simpler. */
+ * code any simpler.
+ */
 class Value {
- protected:
+ public:
+    enum Type {
+        kNoneType,
+        kInteger,
+        kFloat,
+        kSequence,
+    };
+
+ private:
+    Type type_;
+    union {
+        int intValue_;
+        double floatValue_;
+        const Sequence *sequence_;
+    };
+
+    inline void acquire() const;
+    inline void release() const;
+
+    enum Operation {
+        kAddition,
+        kSubtraction,
+        kMultiplication,
+        kDivision,
+        kPower,
+    };
+
+    /**
+     * @brief Apply arithmetic operation to each pair of elements of two
+     * vectors of the same size, or to each element of a vector and a scalar.
+     * Result is a new vector.
+     */
+    Value applyElementWise(const Value &r, Operation op) const;
+
+ public:
+    static const Value kNone;
+
+    Value() : type_(kNoneType), sequence_(nullptr) { }
+
+    explicit Value(int v) : type_(kInteger), intValue_(v) { }
+
+    explicit Value(double v) : type_(kFloat), floatValue_(v) { }
+
     /**
-     * @brief Check that arguments are valid for scalar arithmetic operations,
-     * i.e. are not range values.
+     * @brief Create a reference to a sequence.  Sequence is destroyed when the
+     * last reference to it is gone.
      */
-    void checkScalarArgs(const ValuePtr &r) const {
-        if (!this->isScalar() || !r->isScalar()) {
-            auto msg = "Cannot perform arithmetic operation on vector values.";
-            throw std::invalid_argument(msg);
+    explicit Value(const Sequence *s) : type_(kSequence), sequence_(s) {
+        this->acquire();
+    }
+
+    Value(const Value &v) : type_(v.type_), floatValue_(v.floatValue_) {
+        if (this->type_ == kSequence) {
+            this->sequence_ = v.sequence_;
+            this->acquire();
         }
     }
 
- public:
-    virtual bool isScalar() const {
-        return true;
+    Value(Value &&v) noexcept : type_(v.type_), floatValue_(v.floatValue_) {
+        if (this->type_ == kSequence) {
+            this->sequence_ = v.sequence_;
+            v.type_ = kNoneType;
+        }
     }
 
-    virtual bool isScalarFloat() const {
-        return false;
+    Value &operator=(const Value &v) {
+        if (v.type_ == kSequence) {
+            v.acquire();
+        }
+        if (this->type_ == kSequence) {
+            this->release();
+        }
+        this->type_ = v.type_;
+        if (v.type_ == kSequence) {
+            this->sequence_ = v.sequence_;
+        } else {
+            this->floatValue_ = v.floatValue_;
+        }
+        return *this;
     }
 
-    static const ValuePtr kNone;
+    Value &operator=(Value &&v) noexcept {
+        if (this != &v) {
+            if (this->type_ == kSequence) {
+                this->release();
+            }
+            this->type_ = v.type_;
+            this->floatValue_ = v.floatValue_;
+            if (v.type_ == kSequence) {
+                this->sequence_ = v.sequence_;
+                v.type_ = kNoneType;
+            }
+        }
+        return *this;
+    }
 
-    virtual bool isNone() const {
-        return false;
+    ~Value() {
+        if (this->type_ == kSequence) {
+            this->release();
+        }
     }
 
-    virtual const std::string asString() const = 0;
+    Type getType() const {
+        return this->type_;
+    }
 
-    virtual int asInteger() const = 0;
+    bool isNone() const {
+        return this->type_ == kNoneType;
+    }
 
-    virtual double asFloat() const {
-        return static_cast<double>(this->asInteger());
+    bool isScalar() const {
+        return this->type_ != kSequence;
     }
 
-    ValuePtr add(const ValuePtr &r) const;
-    ValuePtr sub(const ValuePtr &r) const;
-    ValuePtr mul(const ValuePtr &r) const;
-    ValuePtr div(const ValuePtr &r) const;
-    ValuePtr pow(const ValuePtr &r) const;
+    bool isScalarFloat() const {
+        return this->type_ == kFloat;
+    }
 
-    virtual ValuePtr asScalar() const {
-        return std::shared_ptr<const Value>(this);
+    /**
+     * @brief Get sequence referenced by this value.
+     * @returns nullptr for scalar values.
+     */
+    const Sequence *getSequence() const {
+        return this->type_ == kSequence ? this->sequence_ : nullptr;
     }
 
+    const std::string asString() const;
+
+    /**
+     * @brief Write the same text as asString() does, element by element.
+     */
+    void print(Output *out) const;
+
     /**
-     * @brief Get next value in a sequence.
-     * @returns Next value in an integer sequence or kNone if this is the last
-     * item in sequence.
+     * @brief Get a value that can outlive the current statement.  Sequence
+     * allocated in the arena of temporaries is copied to the heap.
      */
-    virtual ValuePtr next() const {
-        return Value::kNone;
+    Value promote() const;
+
+    int asInteger() const {
+        switch (this->type_) {
+            case kInteger:
+                return this->intValue_;
+            case kFloat:
+                return static_cast<int>(this->floatValue_);
+            default:
+                return this->sequenceAsInteger();
+        }
+    }
+
+    double asFloat() const {
+        if (this->type_ == kFloat) {
+            return this->floatValue_;
+        } else {
+            return static_cast<double>(this->asInteger());
+        }
     }
 
+    /**
+     * @brief Integer value of a non-scalar value.  For sequences this is the
+     * first element.
+     */
+    int sequenceAsInteger() const;
+
+    Value add(const Value &r) const;
+    Value sub(const Value &r) const;
+    Value mul(const Value &r) const;
+    Value div(const Value &r) const;
+    Value pow(const Value &r) const;
+
     /**
      * @brief Size of this vector. Makes sense only for non-scalar types.
      */
-    virtual int getSize() const {
-        return 1;
-    }
+    int getSize() const;
 
     /**
-     * @brief Get a slice of the original vector.
+     * @brief Bytes held by the sequence, 0 for scalars.
      */
-    virtual ValuePtr getSlice(int begin, int end) const {
-        return Value::kNone;
-    }
+    size_t getMemoryUsage() const;
+
+    /**
+     * @brief Iterate over elements [begin, end) of a sequence.
+     *
+     * Elements are passed to the callback in chunks of unboxed values,
+     * without allocating anything per element.  Chunks are passed in order.
+     * Does nothing for scalar values.
+     */
+    void forEachChunk(int begin, int end, const ChunkCallback &callback) const;
 };
 
-class NoneValue : public Value {
- public:
-    virtual int asInteger() const {
-        return 0xdeadbeef;
+/**
+ * @brief Base class of values allocated on the heap: vectors and ranges.
+ *
+ * Sequences are immutable and shared between Value objects with a reference
+ * counter.  Sequences created by the main thread while a statement is
+ * executed are allocated in the arena of temporaries, and have to be promoted
+ * to outlive the statement.
+ */
+class Sequence : public ArenaAllocated<Arena::kTemporaries> {
+    friend class Value;
+
+ private:
+    /* Most references to a sequence are made by the thread that created it,
+     * that counts them without atomic operations.  Other threads count
+     * their references in the shared counter, which also holds a single
+     * reference for all references of the owner.  */
+    const void *owner_;
+    mutable int ownerRefs_;
+    mutable std::atomic<int> sharedRefs_;
+
+    /**
+     * @brief Identity of the calling thread.
+     */
+    static const void *currentThread() {
+        static thread_local char thread;
+        return &thread;
     }
-    virtual const std::string asString() const {
-        static const std::string s = "(none)";
-        return s;
+
+ public:
+    Sequence()
+        : owner_(currentThread()), ownerRefs_(0), sharedRefs_(0) { }
+
+    virtual ~Sequence() { }
+
+    virtual const std::string asString() const = 0;
+
+    virtual int asInteger() const = 0;
+
+    /**
+     * @brief Create a copy of this sequence.  Elements are shared.
+     */
+    virtual Sequence *clone() const = 0;
+
+    /**
+     * @brief Get an element of a sequence by its index.
+     */
+    virtual Value getItem(int index) const = 0;
+
+    virtual int getSize() const = 0;
+
+    /**
+     * @brief Bytes held by the sequence and its elements.  Elements shared
+     * with other sequences are counted for each of them.
+     */
+    virtual size_t getMemoryUsage() const = 0;
+
+    /**
+     * @brief Whether elements are floats.  All elements of a sequence have
+     * the same type.
+     */
+    virtual bool isFloat() const = 0;
+
+    /**
+     * @brief See Value::forEachChunk().
+     */
+    virtual void forEachChunk(int begin, int end,
+                              const ChunkCallback &callback) const = 0;
+};
+
+inline void Value::acquire() const {
+    auto s = this->sequence_;
+    if (s->owner_ == Sequence::currentThread() && s->ownerRefs_++ > 0) {
+        return;
     }
+    s->sharedRefs_.fetch_add(1, std::memory_order_relaxed);
+}
 
-    virtual bool isNone() const {
-        return true;
+inline void Value::release() const {
+    auto s = this->sequence_;
+    if (s->owner_ == Sequence::currentThread() && --s->ownerRefs_ > 0) {
+        return;
     }
-};
+    if (s->sharedRefs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete s;
+    }
+}
 
-class VectorValue : public Value {
+class VectorValue : public Sequence {
  private:
-    std::shared_ptr< std::vector< ValuePtr > > vec_;
+    std::shared_ptr<const Column> column_;
     int begin_;
     int end_;
 
  public:
-    virtual bool isScalar() const {
-        return false;
+    explicit VectorValue(Column *column)
+        : column_(MemoryStats::track(column)), begin_(0),
+          end_(column->getSize()) {
+        MemoryStats::objectCreated(MemoryStats::kVector);
     }
 
-    explicit VectorValue(std::vector<ValuePtr> *vec)
-        : vec_(vec), begin_(0), end_(vec->size()) {
+    VectorValue(const VectorValue &vv, int begin, int end)
+        : column_(vv.column_), begin_(begin), end_(end) {
+        MemoryStats::objectCreated(MemoryStats::kVector);
     }
 
-    VectorValue(const VectorValue &vv, int begin, int end)
-        : vec_(vv.vec_), begin_(begin), end_(end) {
+    virtual ~VectorValue() {
+        MemoryStats::objectDestroyed(MemoryStats::kVector);
     }
 
     virtual int asInteger() const {
-        return (*this->vec_)[this->begin_]->asInteger();
+        return this->column_->getInteger(this->begin_);
     }
 
-    virtual ValuePtr asScalar() const;
-
     virtual const std::string asString() const;
 
-    virtual ValuePtr next() const;
+    virtual Sequence *clone() const {
+        return new VectorValue(*this, this->begin_, this->end_);
+    }
+
+    virtual Value getItem(int index) const;
 
     virtual int getSize() const {
         return this->end_ - this->begin_;
     }
 
-    virtual ValuePtr getSlice(int begin, int end) const {
-        return std::make_shared<const VectorValue>(
-            *this, this->begin_ + begin, this->begin_ + end);
+    virtual size_t getMemoryUsage() const {
+        return sizeof(*this) + this->column_->getMemoryUsage();
+    }
+
+    virtual bool isFloat() const {
+        return this->column_->isFloat();
     }
+
+    virtual void forEachChunk(int begin, int end,
+                              const ChunkCallback &callback) const;
 };
 
-class IntegerRangeValue : public Value {
+class IntegerRangeValue : public Sequence {
  private:
     int current_;
     int end_;
 
  public:
-    virtual bool isScalar() const {
-        return false;
-    }
-
     IntegerRangeValue(int begin, int end)
         : current_(begin), end_(end) {
+        MemoryStats::objectCreated(MemoryStats::kRange);
+    }
+
+    virtual ~IntegerRangeValue() {
+        MemoryStats::objectDestroyed(MemoryStats::kRange);
     }
 
     virtual const std::string asString() const;
@@ -176,74 +416,52 @@ class IntegerRangeValue : public Value {
         return this->current_;
     }
 
-    virtual ValuePtr asScalar() const;
+    virtual Sequence *clone() const {
+        return new IntegerRangeValue(this->current_, this->end_);
+    }
 
     /**
-     * @brief Get next value in a sequence.
-     * @returns Next value in an integer sequence or kNone if this is the last
-     * item in sequence.
+     * @brief Value of the first element.
      */
-    virtual ValuePtr next() const;
-
-    virtual int getSize() const {
-        return this->end_ - this->current_ + 1;
+    int getFirst() const {
+        return this->current_;
     }
 
-    virtual ValuePtr getSlice(int begin, int end) const {
-        return std::make_shared<const IntegerRangeValue>(
-            this->current_ + begin,
-            std::min(this->end_, this->current_ + end - 1));
+    virtual Value getItem(int index) const {
+        return Value(this->current_ + index);
     }
-};
-
-class ScalarValue : public Value {
- private:
-    enum ValueType {
-        kInteger,
-        kFloat,
-    };
-
-    ValueType type_;
-    union {
-        int intValue_;
-        double floatValue_;
-    };
-
-    explicit ScalarValue(ValueType vt) : type_(vt) { }
 
- public:
-    virtual bool isScalar() const {
-        return true;
+    /**
+     * @brief Number of elements, ranges with end before the beginning are
+     * empty.
+     */
+    virtual int getSize() const {
+        return std::max(0, this->end_ - this->current_ + 1);
     }
 
-    virtual bool isScalarFloat() const {
-        return (this->type_ == kFloat);
+    virtual size_t getMemoryUsage() const {
+        return sizeof(*this);
     }
 
-    explicit ScalarValue(int v)
-        : type_(kInteger), intValue_(v) {
+    virtual bool isFloat() const {
+        return false;
     }
 
-    explicit ScalarValue(double v)
-        : type_(kFloat), floatValue_(v) {
-    }
+    /**
+     * @brief Iterate over elements of a range.  Elements are generated into a
+     * fixed size buffer on the stack, one chunk at a time.
+     */
+    virtual void forEachChunk(int begin, int end,
+                              const ChunkCallback &callback) const;
+};
 
-    ScalarValue(const ScalarValue& v)
-        : Value(v) {
-        this->type_ = v.type_;
-        if (v.type_ == kInteger) {
-            this->intValue_ = v.intValue_;
-        } else {
-            this->floatValue_ = v.floatValue_;
-        }
+inline Value Chunk::getItem(int index) const {
+    if (this->floats != nullptr) {
+        return Value(this->floats[index]);
+    } else {
+        return Value(this->integers[index]);
     }
-
-    virtual const std::string asString() const;
-
-    virtual int asInteger() const;
-
-    virtual double asFloat() const;
-};
+}
 
 #endif  // VALUE_H_
 
@@ -0,0 +1,141 @@
+/* Binary files of vectors.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vectorfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <limits>
+#include <stdexcept>
+
+#include "column.h"
+
+/**
+ * @brief Throw an error about the file, with description of errno.
+ */
+static void fileError(const std::string &action, const std::string &path) {
+    throw std::runtime_error("Can't " + action + " file `" + path + "': " +
+                             strerror(errno));
+}
+
+void VectorFile::save(const std::string &path, const Value &value) {
+    if (value.isScalar()) {
+        throw std::invalid_argument("Can't save scalar value.");
+    }
+
+    auto isFloat = value.getSequence()->isFloat();
+    Header header = {
+        kMagic,
+        static_cast<uint32_t>(isFloat ? Column::kFloat : Column::kInteger),
+        static_cast<uint64_t>(value.getSize()),
+    };
+
+    auto tempPath = path + ".XXXXXX";
+    int fd = mkstemp(&tempPath[0]);
+    if (fd < 0) {
+        fileError("save", path);
+    }
+    auto file = fdopen(fd, "wb");
+    if (file == nullptr) {
+        close(fd);
+        unlink(tempPath.c_str());
+        fileError("save", path);
+    }
+
+    /* Elements of a vector are written right from the column, ranges are
+     * generated into a buffer by chunks.  */
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    value.forEachChunk(0, value.getSize(), [&](const Chunk &chunk) {
+        if (!ok) {
+            return;
+        }
+        if (isFloat) {
+            ok = fwrite(chunk.floats, sizeof(double), chunk.size, file) ==
+                 static_cast<size_t>(chunk.size);
+        } else {
+            ok = fwrite(chunk.integers, sizeof(int), chunk.size, file) ==
+                 static_cast<size_t>(chunk.size);
+        }
+    });
+    /* mkstemp() creates files readable only by the owner.  */
+    ok = ok && fchmod(fd, 0644) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        auto error = errno;
+        unlink(tempPath.c_str());
+        errno = error;
+        fileError("save", path);
+    }
+}
+
+Value VectorFile::load(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fileError("load", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        fileError("load", path);
+    }
+    size_t bytes = st.st_size;
+    if (bytes < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error("File `" + path + "' is not a vector.");
+    }
+
+    /* Mapping is private, so pages that are written to, if any, never get
+     * back to the file.  */
+    auto p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fileError("load", path);
+    }
+
+    auto header = static_cast<const Header*>(p);
+    size_t elementSize = header->type == Column::kInteger ? sizeof(int)
+                                                          : sizeof(double);
+    auto size = (bytes - sizeof(Header)) / elementSize;
+    if (header->magic != kMagic ||
+            (header->type != Column::kInteger &&
+             header->type != Column::kFloat) ||
+            header->size != size ||
+            size * elementSize != bytes - sizeof(Header)) {
+        munmap(p, bytes);
+        throw std::runtime_error("File `" + path + "' is not a vector.");
+    }
+    if (size > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        munmap(p, bytes);
+        throw std::runtime_error("Vector in file `" + path +
+                                 "' is too large.");
+    }
+    madvise(p, bytes, MADV_SEQUENTIAL);
+
+    auto column = new Column();
+    column->adopt(static_cast<Column::Type>(header->type),
+                  static_cast<char*>(p) + sizeof(Header), size);
+    return Value(new VectorValue(column));
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,69 @@
+/* Binary files of vectors.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VECTORFILE_H_
+#define VECTORFILE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "value.h"
+
+/**
+ * @brief Files written by `save' and read by `load'.
+ *
+ * A file is a header followed by raw elements in native byte order, 4 byte
+ * integers or 8 byte doubles, exactly as they are stored in a column.  So a
+ * file is loaded by mapping it into memory and using the mapping as the
+ * column of a vector, without parsing or copying.  Pages are read on first
+ * access, so loading itself takes the same time for any size of a file.
+ */
+class VectorFile {
+ public:
+    struct Header {
+        /* kMagic, also tells apart files of a different byte order.  */
+        uint32_t magic;
+        /* Column::Type of elements.  */
+        uint32_t type;
+        /* Number of elements.  */
+        uint64_t size;
+    };
+
+    static const uint32_t kMagic = 0x43455649;  // "IVEC"
+
+    /**
+     * @brief Write a sequence to a file.  File is replaced only when all of
+     * it has been written, so a vector can be saved over the file it was
+     * loaded from.
+     *
+     * @throws std::invalid_argument if value is a scalar.
+     * @throws std::runtime_error if file can't be written.
+     */
+    static void save(const std::string &path, const Value &value);
+
+    /**
+     * @brief Map a file written by save() as a vector.
+     *
+     * @throws std::runtime_error if file can't be read or isn't a vector.
+     */
+    static Value load(const std::string &path);
+};
+
+#endif  // VECTORFILE_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
@@ -0,0 +1,147 @@
+/* Bytecode representation of expressions and a virtual machine to run it.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vm.h"
+
+#include <limits>
+#include <stdexcept>
+
+#include "options.h"
+
+Value Bytecode::run(Context *ctx, Value *r) const {
+    for (auto &&i : this->code_) {
+        switch (i.op) {
+            case Instruction::kConst:
+                r[i.dst] = this->constants_[i.a];
+                break;
+            case Instruction::kLoadVariable:
+                r[i.dst] = ctx->getVariable(i.a);
+                break;
+            case Instruction::kAdd:
+                r[i.dst] = r[i.a].add(r[i.b]);
+                break;
+            case Instruction::kSub:
+                r[i.dst] = r[i.a].sub(r[i.b]);
+                break;
+            case Instruction::kMul:
+                r[i.dst] = r[i.a].mul(r[i.b]);
+                break;
+            case Instruction::kDiv:
+                r[i.dst] = r[i.a].div(r[i.b]);
+                break;
+            case Instruction::kPow:
+                r[i.dst] = r[i.a].pow(r[i.b]);
+                break;
+            case Instruction::kRange:
+                r[i.dst] = Value(new IntegerRangeValue(r[i.a].asInteger(),
+                                                       r[i.b].asInteger()));
+                break;
+            case Instruction::kLoadFile:
+                r[i.dst] = this->loads_[i.a]->evaluate(ctx);
+                break;
+            case Instruction::kMap:
+                r[i.dst] = this->maps_[i.b]->apply(r[i.a]);
+                break;
+            case Instruction::kCheckReduceInput:
+                this->reductions_[i.b]->checkInput(r[i.a]);
+                break;
+            case Instruction::kReduce:
+                r[i.dst] = this->reductions_[i.c]->apply(r[i.a], r[i.b]);
+                break;
+            case Instruction::kReturn:
+                return r[i.a];
+        }
+    }
+    return Value::kNone;
+}
+
+Value Bytecode::run(Context *ctx) const {
+    std::vector<Value> registers(this->registersCount_);
+    return this->run(ctx, registers.data());
+}
+
+int Compiler::checkLimit(size_t index) {
+    if (index > std::numeric_limits<uint16_t>::max()) {
+        throw std::length_error("Expression is too complex.");
+    }
+    return index;
+}
+
+int Compiler::newRegister() {
+    return checkLimit(this->code_->registersCount_++);
+}
+
+void Compiler::emit(Instruction::Opcode op, int dst, int a, int b, int c) {
+    Instruction i = {
+        static_cast<uint16_t>(op),
+        static_cast<uint16_t>(dst),
+        static_cast<uint16_t>(a),
+        static_cast<uint16_t>(b),
+        static_cast<uint16_t>(c),
+    };
+    this->code_->code_.push_back(i);
+}
+
+int Compiler::addConstant(const Value &value) {
+    this->code_->constants_.push_back(value);
+    return checkLimit(this->code_->constants_.size() - 1);
+}
+
+int Compiler::addMap(const MapExpression *map) {
+    this->code_->maps_.push_back(map);
+    return checkLimit(this->code_->maps_.size() - 1);
+}
+
+int Compiler::addReduce(const ReduceExpression *reduce) {
+    this->code_->reductions_.push_back(reduce);
+    return checkLimit(this->code_->reductions_.size() - 1);
+}
+
+int Compiler::addLoad(const LoadExpression *load) {
+    this->code_->loads_.push_back(load);
+    return checkLimit(this->code_->loads_.size() - 1);
+}
+
+int Compiler::loadVariable(int slot) {
+    if (this->isLambda_) {
+        return slot;
+    }
+
+    auto result = this->newRegister();
+    this->emit(Instruction::kLoadVariable, result, checkLimit(slot));
+    return result;
+}
+
+std::unique_ptr<const Bytecode> Compiler::compile(const Expression *expr) {
+    auto result = expr->compile(this);
+    this->emit(Instruction::kReturn, 0, result);
+
+    std::unique_ptr<const Bytecode> code(this->code_);
+    this->code_ = nullptr;
+    return code;
+}
+
+Value evaluateExpression(const Expression *expr, Context *ctx) {
+    if (Options::get().engine == Options::kTreeWalker) {
+        return expr->evaluate(ctx);
+    }
+
+    Compiler compiler;
+    return compiler.compile(expr)->run(ctx);
+}
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab
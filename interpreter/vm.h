@@ -0,0 +1,179 @@
+/* Bytecode representation of expressions and a virtual machine to run it.
+ * Copyright (C) 2017 Anton Kolesov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VM_H_
+#define VM_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "context.h"
+#include "expression.h"
+#include "value.h"
+
+/**
+ * @brief Single instruction of a register machine.
+ *
+ * Every operand is an index: of a register, of a constant, of a context slot
+ * or of a map or reduce expression, depending on the opcode.
+ */
+struct Instruction {
+    enum Opcode {
+        kConst,             // dst = constants[a]
+        kLoadVariable,      // dst = ctx[a]
+        kAdd,               // dst = a + b
+        kSub,               // dst = a - b
+        kMul,               // dst = a * b
+        kDiv,               // dst = a / b
+        kPow,               // dst = a ^ b
+        kRange,             // dst = {a, b}
+        kLoadFile,          // dst = loads[a]
+        kMap,               // dst = maps[b](a)
+        kCheckReduceInput,  // throw if a can't be reduced by reductions[b]
+        kReduce,            // dst = reductions[c](a, b)
+        kReturn,            // return a
+    };
+
+    uint16_t op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+/**
+ * @brief Compiled expression: either top level statement expression or body
+ * of a lambda.
+ *
+ * Parameters of a lambda occupy first registers, so caller passes arguments
+ * by writing them into the register file before calling run().
+ */
+class Bytecode {
+    friend class Compiler;
+
+ private:
+    std::vector<Instruction> code_;
+    std::vector<Value> constants_;
+    /* Map, reduce and load are executed by their expressions, which outlive
+     * the code: top level code is discarded after a single run, and code of
+     * a lambda is owned by the lambda.  */
+    std::vector<const MapExpression*> maps_;
+    std::vector<const ReduceExpression*> reductions_;
+    std::vector<const LoadExpression*> loads_;
+    int registersCount_;
+
+ public:
+    Bytecode() : registersCount_(0) { }
+
+    int getRegistersCount() const {
+        return this->registersCount_;
+    }
+
+    const std::vector<Instruction> &getInstructions() const {
+        return this->code_;
+    }
+
+    const Value &getConstant(int index) const {
+        return this->constants_[index];
+    }
+
+    /**
+     * @brief Execute the code.
+     *
+     * @param ctx Context to load variables from.
+     * @param registers Register file, at least getRegistersCount() long.  Can
+     * be reused between calls to avoid allocating it every time.
+     */
+    Value run(Context *ctx, Value *registers) const;
+
+    /**
+     * @brief Execute the code with a temporary register file.
+     */
+    Value run(Context *ctx) const;
+};
+
+/**
+ * @brief Lowers expression tree into the bytecode.
+ *
+ * Each expression node emits its instructions through Expression::compile()
+ * and returns number of register with its result.
+ */
+class Compiler {
+ private:
+    Bytecode *code_;
+    bool isLambda_;
+
+    int checkLimit(size_t index);
+
+ public:
+    /**
+     * @brief Create compiler for a top level expression.
+     */
+    Compiler() : code_(new Bytecode()), isLambda_(false) { }
+
+    /**
+     * @brief Create compiler for a lambda body.
+     */
+    explicit Compiler(int paramsCount)
+        : code_(new Bytecode()), isLambda_(true) {
+        this->code_->registersCount_ = paramsCount;
+    }
+
+    ~Compiler() {
+        delete this->code_;
+    }
+
+    int newRegister();
+
+    void emit(Instruction::Opcode op, int dst, int a = 0, int b = 0,
+              int c = 0);
+
+    int addConstant(const Value &value);
+
+    int addMap(const MapExpression *map);
+
+    int addReduce(const ReduceExpression *reduce);
+
+    int addLoad(const LoadExpression *load);
+
+    /**
+     * @brief Get register that holds value of a variable.
+     *
+     * Lambda parameters are already in registers, top level variables are
+     * loaded from the context.
+     *
+     * @param slot Slot assigned to variable by Expression::resolve().
+     */
+    int loadVariable(int slot);
+
+    /**
+     * @brief Compile the expression.  Compiler can't be used afterwards.
+     */
+    std::unique_ptr<const Bytecode> compile(const Expression *expr);
+};
+
+/**
+ * @brief Evaluate top level expression with the engine selected in options.
+ */
+Value evaluateExpression(const Expression *expr, Context *ctx);
+
+#endif  // VM_H_
+
+// vim: tabstop=4 softtabstop=4 shiftwidth=4 expandtab